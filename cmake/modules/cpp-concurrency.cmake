@@ -1,5 +1,9 @@
 # Helper functions for CPP Concurrency CMake setup
 
+# Shared headers (e.g., the vectorised maths functions) used by several
+# of the examples
+include_directories("${CMAKE_CURRENT_LIST_DIR}/../../src/common")
+
 # Define the function used to build a simple C++11 threaded executable,
 # adding the correct thread library
 function(simple_thread_exe TARGET)
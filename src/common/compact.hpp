@@ -0,0 +1,284 @@
+// Order preserving parallel stream compaction
+//
+// compact::copy_if(first, n, pred) returns, in a std::vector, the elements
+// of [first, first + n) for which pred is true, in their original order.
+// Pushing the selected elements onto a concurrent_vector from a
+// parallel_for instead serialises on the container's growth and leaves
+// them in whatever order the threads got there.
+//
+// The input is cut into fixed blocks and then
+//
+//  1. a parallel count pass finds how many elements of each block pass
+//  2. parallel_scan turns the counts into each block's exclusive offset in
+//     the output, and the total, so the output is allocated exactly once
+//  3. a parallel scatter pass copies each block's elements to its offset
+//
+// so the output is deterministic for any number of threads. Blocks of
+// pointers and std::vector iterators are read through a pointer, with the
+// SIMD kernels below; other random access iterators (e.g.,
+// concurrent_vector's, whose storage is in separate segments) are read
+// element by element.
+//
+// For floats with the compact::greater predicate, x > threshold, the block
+// count and compress use SIMD: on AVX-512 a compare mask, popcount and
+// compressed store, on AVX2 a compare, movemask, popcount and a permute
+// from a table of the 256 lane patterns. Other predicates and types use
+// the scalar loops.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "tbb/tbb.h"
+
+#include "simdmath.hpp"
+
+#ifndef COMPACT_H
+#define COMPACT_H 1
+
+namespace compact {
+
+  // The predicate x > threshold, which has SIMD kernels for float
+  template <typename T>
+  struct greater {
+    T threshold;
+
+    bool operator()(const T& x) const { return x > threshold; }
+  };
+
+  namespace detail {
+
+    // Scalar kernels, for any predicate
+    template <typename T, typename Pred>
+    inline size_t count_block(const T* in, size_t n, Pred pred) {
+      size_t count = 0;
+      for (size_t i=0; i<n; ++i)
+        count += pred(in[i]) ? 1 : 0;
+      return count;
+    }
+
+    template <typename T, typename Pred>
+    inline void compress_block(const T* in, size_t n, T* out, size_t, Pred pred) {
+      for (size_t i=0; i<n; ++i)
+        if (pred(in[i]))
+          *out++ = in[i];
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+
+    __attribute__((target("avx512f,popcnt")))
+    inline size_t count_greater_avx512(const float* in, size_t n, float threshold) {
+      const __m512 t = _mm512_set1_ps(threshold);
+      size_t count = 0, i = 0;
+      for (; i + 16 <= n; i += 16)
+        count += __builtin_popcount(_mm512_cmp_ps_mask(_mm512_loadu_ps(in + i), t, _CMP_GT_OQ));
+      for (; i < n; ++i)
+        count += in[i] > threshold ? 1 : 0;
+      return count;
+    }
+
+    // Compressed stores only write the selected lanes, so they can't spill
+    // into the next block's output
+    __attribute__((target("avx512f")))
+    inline void compress_greater_avx512(const float* in, size_t n, float* out, float threshold) {
+      const __m512 t = _mm512_set1_ps(threshold);
+      size_t i = 0;
+      for (; i + 16 <= n; i += 16) {
+        __m512 v = _mm512_loadu_ps(in + i);
+        __mmask16 m = _mm512_cmp_ps_mask(v, t, _CMP_GT_OQ);
+        _mm512_mask_compressstoreu_ps(out, m, v);
+        out += __builtin_popcount(m);
+      }
+      for (; i < n; ++i)
+        if (in[i] > threshold)
+          *out++ = in[i];
+    }
+
+    // For each 8 bit lane mask, the indices of the set lanes first
+    struct permute_table {
+      uint32_t index[256][8];
+
+      permute_table() {
+        for (int m=0; m<256; ++m) {
+          int k = 0;
+          for (int lane=0; lane<8; ++lane)
+            if (m & (1 << lane))
+              index[m][k++] = lane;
+          for (; k<8; ++k)
+            index[m][k] = 0;
+        }
+      }
+    };
+
+    inline const permute_table& avx2_permutes() {
+      static const permute_table table;
+      return table;
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    inline size_t count_greater_avx2(const float* in, size_t n, float threshold) {
+      const __m256 t = _mm256_set1_ps(threshold);
+      size_t count = 0, i = 0;
+      for (; i + 8 <= n; i += 8)
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(in + i), t, _CMP_GT_OQ)));
+      for (; i < n; ++i)
+        count += in[i] > threshold ? 1 : 0;
+      return count;
+    }
+
+    // Each permuted vector is stored whole, so the vector loop stops while
+    // there are still at least 8 places left in this block's output
+    __attribute__((target("avx2,popcnt")))
+    inline void compress_greater_avx2(const float* in, size_t n, float* out, size_t count,
+      float threshold) {
+      const permute_table& table = avx2_permutes();
+      const __m256 t = _mm256_set1_ps(threshold);
+      float* const out_end = out + count;
+      size_t i = 0;
+      for (; i + 8 <= n && out + 8 <= out_end; i += 8) {
+        __m256 v = _mm256_loadu_ps(in + i);
+        int m = _mm256_movemask_ps(_mm256_cmp_ps(v, t, _CMP_GT_OQ));
+        __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(table.index[m]));
+        _mm256_storeu_ps(out, _mm256_permutevar8x32_ps(v, index));
+        out += __builtin_popcount(m);
+      }
+      for (; i < n; ++i)
+        if (in[i] > threshold)
+          *out++ = in[i];
+    }
+
+#endif
+
+    inline size_t count_block(const float* in, size_t n, greater<float> pred) {
+#if defined(__x86_64__) || defined(__i386__)
+      switch (simdmath::active_isa()) {
+        case simdmath::isa::avx512: return count_greater_avx512(in, n, pred.threshold);
+        case simdmath::isa::avx2: return count_greater_avx2(in, n, pred.threshold);
+        default: break;
+      }
+#endif
+      return count_block<float, greater<float>>(in, n, pred);
+    }
+
+    inline void compress_block(const float* in, size_t n, float* out, size_t count,
+      greater<float> pred) {
+#if defined(__x86_64__) || defined(__i386__)
+      switch (simdmath::active_isa()) {
+        case simdmath::isa::avx512: return compress_greater_avx512(in, n, out, pred.threshold);
+        case simdmath::isa::avx2: return compress_greater_avx2(in, n, out, count, pred.threshold);
+        default: break;
+      }
+#endif
+      compress_block<float, greater<float>>(in, n, out, count, pred);
+    }
+
+    // Iterators whose whole range is known to be contiguous in memory
+    template <typename Iterator>
+    struct is_contiguous {
+      typedef typename std::iterator_traits<Iterator>::value_type T;
+      static const bool value = std::is_pointer<Iterator>::value ||
+        std::is_same<Iterator, typename std::vector<T>::iterator>::value ||
+        std::is_same<Iterator, typename std::vector<T>::const_iterator>::value;
+    };
+
+    // The block [b, e) as a pointer, or nullptr if the iterator may not be
+    // contiguous (comparing addresses within a block can't tell, as the
+    // segments in between could be anywhere)
+    template <typename Iterator>
+    inline const typename std::iterator_traits<Iterator>::value_type*
+    contiguous(Iterator first, size_t b, size_t) {
+      if (is_contiguous<Iterator>::value)
+        return &*(first + b);
+      return nullptr;
+    }
+
+    // Running total for the exclusive scan of the block counts
+    class offset_scan {
+    private:
+      const std::vector<size_t>& m_counts;
+      std::vector<size_t>& m_offsets;
+
+    public:
+      size_t sum;
+
+      offset_scan(const std::vector<size_t>& counts, std::vector<size_t>& offsets):
+        m_counts(counts), m_offsets(offsets), sum{0} {};
+
+      offset_scan(offset_scan& b, tbb::split):
+        m_counts(b.m_counts), m_offsets(b.m_offsets), sum{0} {};
+
+      template <typename Tag>
+      void operator()(const tbb::blocked_range<size_t>& r, Tag) {
+        size_t running = sum;
+        for (size_t i=r.begin(); i!=r.end(); ++i) {
+          if (Tag::is_final_scan())
+            m_offsets[i] = running;
+          running += m_counts[i];
+        }
+        sum = running;
+      }
+
+      void reverse_join(offset_scan& a) { sum = a.sum + sum; }
+      void assign(offset_scan& b) { sum = b.sum; }
+    };
+
+  } // namespace detail
+
+  template <typename Iterator, typename Pred>
+  std::vector<typename std::iterator_traits<Iterator>::value_type>
+  copy_if(Iterator first, size_t n, Pred pred, size_t block = 1 << 14) {
+    typedef typename std::iterator_traits<Iterator>::value_type T;
+    block = std::max<size_t>(block, 1);
+    const size_t blocks = (n + block - 1) / block;
+
+    // Count pass
+    std::vector<size_t> counts(blocks), offsets(blocks);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, blocks),
+      [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t k=r.begin(); k!=r.end(); ++k) {
+          size_t b = k * block, e = std::min(n, b + block);
+          if (const T* p = detail::contiguous(first, b, e)) {
+            counts[k] = detail::count_block(p, e - b, pred);
+          } else {
+            size_t count = 0;
+            for (size_t i=b; i<e; ++i)
+              count += pred(first[i]) ? 1 : 0;
+            counts[k] = count;
+          }
+        }
+      });
+
+    // Offsets of the blocks in the output
+    detail::offset_scan scan(counts, offsets);
+    tbb::parallel_scan(tbb::blocked_range<size_t>(0, blocks), scan);
+
+    // Scatter pass
+    std::vector<T> out(scan.sum);
+    T* out_data = out.data();
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, blocks),
+      [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t k=r.begin(); k!=r.end(); ++k) {
+          size_t b = k * block, e = std::min(n, b + block);
+          T* o = out_data + offsets[k];
+          if (const T* p = detail::contiguous(first, b, e)) {
+            detail::compress_block(p, e - b, o, counts[k], pred);
+          } else {
+            for (size_t i=b; i<e; ++i)
+              if (pred(first[i]))
+                *o++ = first[i];
+          }
+        }
+      });
+    return out;
+  }
+
+} // namespace compact
+
+#endif  // COMPACT_H
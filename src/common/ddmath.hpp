@@ -0,0 +1,215 @@
+// Double-double arithmetic
+//
+// A dd holds a number as the unevaluated sum hi + lo of two doubles, with
+// |lo| <= ulp(hi)/2, which gives about 106 bits (32 decimal digits) of
+// precision with the range of a double. Addition, subtraction and
+// multiplication use the error free transformations of Knuth (two_sum)
+// and Dekker (two_prod, with Dekker's split so no FMA is needed), so they
+// are accurate to a few units in the last place of the pair.
+//
+// This is enough for things that need more precision than a double but
+// only a modest number of operations, e.g., the reference orbit of a deep
+// Mandelbrot zoom. It is far cheaper than arbitrary precision, but still
+// some ten times the cost of plain double arithmetic.
+//
+// Floating point contraction is switched off here, as an FMA in the wrong
+// place breaks the error free transformations.
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#ifndef DD_MATH_H
+#define DD_MATH_H 1
+
+namespace ddmath {
+
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+
+  namespace detail {
+
+    // a + b = s + err exactly
+    inline double two_sum(double a, double b, double& err) {
+      double s = a + b;
+      double bb = s - a;
+      err = (a - (s - bb)) + (b - bb);
+      return s;
+    }
+
+    // As two_sum, for |a| >= |b|
+    inline double quick_two_sum(double a, double b, double& err) {
+      double s = a + b;
+      err = b - (s - a);
+      return s;
+    }
+
+    // Split a into two 26 bit halves, a = hi + lo
+    inline void split(double a, double& hi, double& lo) {
+      const double splitter = 134217729.0;  // 2^27 + 1
+      double t = splitter * a;
+      hi = t - (t - a);
+      lo = a - hi;
+    }
+
+    // a * b = p + err exactly
+    inline double two_prod(double a, double b, double& err) {
+      double p = a * b;
+      double a_hi, a_lo, b_hi, b_lo;
+      split(a, a_hi, a_lo);
+      split(b, b_hi, b_lo);
+      err = ((a_hi * b_hi - p) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo;
+      return p;
+    }
+
+  } // namespace detail
+
+  struct dd {
+    double hi;
+    double lo;
+
+    dd(double h = 0.0): hi{h}, lo{0.0} {};
+    dd(double h, double l): hi{h}, lo{l} {};
+
+    explicit operator double() const { return hi + lo; }
+  };
+
+  inline dd operator-(const dd& a) {
+    return dd(-a.hi, -a.lo);
+  }
+
+  inline dd operator+(const dd& a, const dd& b) {
+    double e1, e2;
+    double s = detail::two_sum(a.hi, b.hi, e1);
+    double t = detail::two_sum(a.lo, b.lo, e2);
+    e1 += t;
+    s = detail::quick_two_sum(s, e1, e1);
+    e1 += e2;
+    s = detail::quick_two_sum(s, e1, e1);
+    return dd(s, e1);
+  }
+
+  inline dd operator-(const dd& a, const dd& b) {
+    return a + (-b);
+  }
+
+  inline dd operator*(const dd& a, const dd& b) {
+    double e;
+    double p = detail::two_prod(a.hi, b.hi, e);
+    e += a.hi * b.lo + a.lo * b.hi;
+    p = detail::quick_two_sum(p, e, e);
+    return dd(p, e);
+  }
+
+  // Long division, one correction step
+  inline dd operator/(const dd& a, const dd& b) {
+    double q1 = a.hi / b.hi;
+    dd r = a - dd(q1) * b;
+    double q2 = r.hi / b.hi;
+    r = r - dd(q2) * b;
+    double q3 = r.hi / b.hi;
+    double e;
+    q1 = detail::quick_two_sum(q1, q2, e);
+    return dd(q1, e) + dd(q3);
+  }
+
+  inline dd& operator+=(dd& a, const dd& b) { return a = a + b; }
+  inline dd& operator-=(dd& a, const dd& b) { return a = a - b; }
+  inline dd& operator*=(dd& a, const dd& b) { return a = a * b; }
+
+  inline bool operator<(const dd& a, const dd& b) {
+    return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+  }
+
+  inline dd sqr(const dd& a) {
+    return a * a;
+  }
+
+  // Parse a decimal number, e.g., "-0.74364388703715870475219150611477",
+  // with an optional exponent; returns false if the string is not one
+  inline bool parse(const std::string& str, dd& value) {
+    size_t pos = 0;
+    bool negative = false;
+    if (pos < str.size() && (str[pos] == '-' || str[pos] == '+'))
+      negative = str[pos++] == '-';
+    dd mantissa(0.0);
+    int exponent = 0, digits = 0;
+    bool point = false;
+    for (; pos < str.size(); ++pos) {
+      char c = str[pos];
+      if (std::isdigit(static_cast<unsigned char>(c))) {
+        mantissa = mantissa * dd(10.0) + dd(c - '0');
+        ++digits;
+        if (point)
+          --exponent;
+      } else if (c == '.' && !point) {
+        point = true;
+      } else {
+        break;
+      }
+    }
+    if (digits == 0)
+      return false;
+    if (pos < str.size() && (str[pos] == 'e' || str[pos] == 'E')) {
+      try {
+        size_t used = 0;
+        exponent += std::stoi(str.substr(pos+1), &used);
+        pos += 1 + used;
+      } catch (...) {
+        return false;
+      }
+    }
+    if (pos != str.size())
+      return false;
+    // Scale by the power of ten with a single multiply or divide
+    dd scale(1.0);
+    for (int e = std::abs(exponent); e > 0; --e)
+      scale *= dd(10.0);
+    value = exponent < 0 ? mantissa / scale : mantissa * scale;
+    if (negative)
+      value = -value;
+    return true;
+  }
+
+  // Decimal string with the given number of significant digits
+  inline std::string to_string(dd a, int digits = 32) {
+    if (a.hi == 0.0 || !std::isfinite(a.hi))
+      return std::to_string(a.hi);
+    std::string out;
+    if (a.hi < 0.0) {
+      out = "-";
+      a = -a;
+    }
+    int exponent = int(std::floor(std::log10(a.hi)));
+    dd scale(1.0);
+    for (int e = std::abs(exponent); e > 0; --e)
+      scale *= dd(10.0);
+    a = exponent < 0 ? a * scale : a / scale;
+    // a is now in [1, 10), up to rounding of the log10 estimate
+    if (a.hi >= 10.0) {
+      a = a / dd(10.0);
+      ++exponent;
+    } else if (a.hi < 1.0) {
+      a = a * dd(10.0);
+      --exponent;
+    }
+    for (int i = 0; i < digits; ++i) {
+      int digit = std::min(9, std::max(0, int(std::floor(a.hi))));
+      out += char('0' + digit);
+      if (i == 0)
+        out += '.';
+      a = (a - dd(digit)) * dd(10.0);
+    }
+    char exp_str[16];
+    std::snprintf(exp_str, sizeof(exp_str), "e%+d", exponent);
+    return out + exp_str;
+  }
+
+#pragma GCC pop_options
+
+} // namespace ddmath
+
+#endif  // DD_MATH_H
@@ -0,0 +1,216 @@
+// Huge page backed arrays, initialised in parallel
+//
+// A big array from new[] or std::vector lives on 4KB pages, so a pass over
+// a few hundred MB needs tens of thousands of TLB entries, and the pages
+// are placed in memory (on NUMA machines, next to a socket) by whichever
+// thread touches them first, usually one thread filling the array
+// serially. hugearray::array instead takes its memory directly from mmap,
+// aligned to 2MB huge pages, with one of these page policies:
+//
+//   normal      - 4KB pages, with transparent huge pages turned off for
+//                 the array (for comparison)
+//   transparent - madvise(MADV_HUGEPAGE), asking the kernel to back the
+//                 array with transparent huge pages (this works when THP
+//                 is "always" or "madvise" in
+//                 /sys/kernel/mm/transparent_hugepage/enabled)
+//   explicit    - MAP_HUGETLB pages from the pool reserved in
+//                 /proc/sys/vm/nr_hugepages; if the pool is too small this
+//                 falls back to transparent
+//
+// pages_used() says which policy the array actually got (transparent only
+// if the advice was taken and THP isn't "never"). Nothing is touched when
+// the array is made (the element type must be trivial), so parallel_init()
+// can then set every element with the same range and partitioner as the
+// loops that use the array; with an affinity_partitioner that is reused,
+// each page is first touched by the thread that will work on it.
+//
+// On systems other than Linux the policy is ignored and the memory comes
+// from posix_memalign.
+
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "tbb/tbb.h"
+
+#ifndef HUGE_ARRAY_H
+#define HUGE_ARRAY_H 1
+
+namespace hugearray {
+
+  const size_t huge_page_size = size_t(2) << 20;
+
+  enum class pages { normal, transparent, explicit_huge };
+
+  inline const char* pages_name(pages p) {
+    switch (p) {
+      case pages::normal: return "normal";
+      case pages::transparent: return "transparent";
+      case pages::explicit_huge: return "explicit";
+    }
+    return "unknown";
+  }
+
+  // Returns false if name is not a page policy
+  inline bool parse_pages(const std::string& name, pages& p) {
+    for (auto candidate: {pages::normal, pages::transparent, pages::explicit_huge}) {
+      if (name == pages_name(candidate)) {
+        p = candidate;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  namespace detail {
+
+#ifdef __linux__
+    // True if the kernel will back MADV_HUGEPAGE regions with transparent
+    // huge pages, i.e., THP is "always" or "madvise", not "never"
+    inline bool transparent_enabled() {
+      static const bool enabled = [] {
+        std::ifstream sys("/sys/kernel/mm/transparent_hugepage/enabled");
+        std::string modes;
+        std::getline(sys, modes);
+        return modes.find("[always]") != std::string::npos ||
+          modes.find("[madvise]") != std::string::npos;
+      }();
+      return enabled;
+    }
+#endif
+
+    inline size_t round_up(size_t bytes) {
+      return (bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
+    }
+
+    // bytes (a multiple of the huge page size) of untouched memory aligned
+    // to a huge page; got is set to the policy that was used, and the
+    // return is nullptr if there's no memory
+    inline void* map(size_t bytes, pages want, pages& got) {
+#ifdef __linux__
+      if (want == pages::explicit_huge) {
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+          got = pages::explicit_huge;
+          return p;
+        }
+        want = pages::transparent;
+      }
+      // Map an extra huge page, then trim the ends to align the start
+      void* raw = mmap(nullptr, bytes + huge_page_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (raw == MAP_FAILED)
+        return nullptr;
+      char* start = static_cast<char*>(raw);
+      char* aligned = reinterpret_cast<char*>(round_up(reinterpret_cast<size_t>(start)));
+      if (aligned > start)
+        munmap(start, aligned - start);
+      size_t tail = (start + bytes + huge_page_size) - (aligned + bytes);
+      if (tail > 0)
+        munmap(aligned + bytes, tail);
+      // If the advice fails (e.g., a kernel without THP) or THP is off,
+      // the array is on normal pages
+      if (madvise(aligned, bytes, want == pages::transparent ? MADV_HUGEPAGE : MADV_NOHUGEPAGE) ||
+          !transparent_enabled())
+        want = pages::normal;
+      got = want;
+      return aligned;
+#else
+      void* p = nullptr;
+      if (posix_memalign(&p, huge_page_size, bytes))
+        return nullptr;
+      got = pages::normal;
+      return p;
+#endif
+    }
+
+    inline void unmap(void* p, size_t bytes) {
+#ifdef __linux__
+      munmap(p, bytes);
+#else
+      (void)bytes;
+      std::free(p);
+#endif
+    }
+
+  } // namespace detail
+
+  template <typename T>
+  class array {
+    static_assert(std::is_trivial<T>::value, "hugearray::array elements are left uninitialised");
+
+  private:
+    T* m_data;
+    size_t m_size;
+    size_t m_bytes;
+    pages m_pages;
+
+  public:
+    // Throws std::bad_alloc if there's no memory
+    array(size_t n, pages want = pages::transparent):
+      m_data{nullptr}, m_size{n}, m_bytes{detail::round_up(n * sizeof(T))}, m_pages{want} {
+      if (m_bytes) {
+        m_data = static_cast<T*>(detail::map(m_bytes, want, m_pages));
+        if (!m_data)
+          throw std::bad_alloc();
+      }
+    }
+
+    ~array() {
+      if (m_data)
+        detail::unmap(m_data, m_bytes);
+    }
+
+    array(const array&) = delete;
+    array& operator=(const array&) = delete;
+
+    array(array&& other):
+      m_data{other.m_data}, m_size{other.m_size}, m_bytes{other.m_bytes}, m_pages{other.m_pages} {
+      other.m_data = nullptr;
+      other.m_size = other.m_bytes = 0;
+    }
+
+    array& operator=(array&& other) {
+      std::swap(m_data, other.m_data);
+      std::swap(m_size, other.m_size);
+      std::swap(m_bytes, other.m_bytes);
+      std::swap(m_pages, other.m_pages);
+      return *this;
+    }
+
+    T* data() { return m_data; }
+    const T* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+    T& operator[](size_t i) { return m_data[i]; }
+    const T& operator[](size_t i) const { return m_data[i]; }
+
+    T* begin() { return m_data; }
+    T* end() { return m_data + m_size; }
+
+    pages pages_used() const { return m_pages; }
+  };
+
+  // Set x[i] = init(i) in parallel, over the range [0, n) with the given
+  // grain size and partitioner, i.e., those of the loops that use x
+  template <typename T, typename Init, typename Partitioner>
+  void parallel_init(T* x, size_t n, Init init, Partitioner& partitioner, size_t grain = 1) {
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, n, grain),
+      [=](const tbb::blocked_range<size_t>& r) {
+        for (size_t i=r.begin(); i!=r.end(); ++i)
+          x[i] = init(i);
+      }, partitioner);
+  }
+
+} // namespace hugearray
+
+#endif  // HUGE_ARRAY_H
@@ -0,0 +1,223 @@
+// Parallel LSD radix sort for integer and floating point keys
+//
+// radix::sort(data, n) sorts n 32 or 64 bit integers, floats or doubles
+// into ascending order (floats as IEEE totalOrder, so -0 comes before +0
+// and NaNs sort to the ends by sign). Each key is mapped to an unsigned
+// integer of the same size whose order is the same:
+//
+//   unsigned - as it is
+//   signed   - flip the sign bit
+//   float    - flip the sign bit of positive values and every bit of
+//              negative values (which are stored as sign and magnitude)
+//
+// then sorted 8 bits at a time from the least significant byte, i.e., 4
+// or 8 stable counting sort passes between two buffers. Each pass:
+//
+//  1. the keys are cut into a fixed number of blocks, and each block's
+//     histogram of the 256 digit values is counted in parallel
+//  2. in parallel over the digits, the histograms become each block's
+//     offset for each digit: all the keys with smaller digits, then the
+//     keys with this digit from earlier blocks
+//  3. each block scatters its keys to those offsets in parallel, through
+//     a small write-combining buffer for each digit that is flushed a
+//     cache line or two at a time, so the 256 output streams don't each
+//     miss the cache on every key
+//
+// A pass where every key has the same digit (e.g., the high bytes of
+// small integers) is skipped, found from the AND and OR of all the keys.
+// The sort is deterministic for any number of threads. It needs two
+// buffers of keys as big as the input besides the data.
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "tbb/tbb.h"
+
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H 1
+
+namespace radix {
+
+  // The unsigned key of each sortable type, and the maps to and from it
+  template <typename T, typename Enable = void> struct key_traits;
+
+  template <typename T>
+  struct key_traits<T, typename std::enable_if<std::is_integral<T>::value>::type> {
+    typedef typename std::make_unsigned<T>::type key;
+    static const key sign = std::is_signed<T>::value ? key(1) << (8 * sizeof(T) - 1) : 0;
+
+    static key to_key(T x) { return key(x) ^ sign; }
+    static T from_key(key k) { return T(k ^ sign); }
+  };
+
+  template <typename T>
+  struct key_traits<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+    static_assert(sizeof(T) == 4 || sizeof(T) == 8, "radix sorts 32 and 64 bit floats");
+    typedef typename std::conditional<sizeof(T) == 4, uint32_t, uint64_t>::type key;
+    static const key sign = key(1) << (8 * sizeof(T) - 1);
+
+    static key to_key(T x) {
+      key k;
+      std::memcpy(&k, &x, sizeof(k));
+      return (k & sign) ? ~k : k | sign;
+    }
+
+    static T from_key(key k) {
+      k = (k & sign) ? k & ~sign : ~k;
+      T x;
+      std::memcpy(&x, &k, sizeof(x));
+      return x;
+    }
+  };
+
+  namespace detail {
+
+    const int radix_bits = 8;
+    const size_t buckets = 1 << radix_bits;
+
+    // Keys per write-combining buffer, 128 bytes
+    template <typename K> struct combine {
+      static const size_t size = 128 / sizeof(K);
+    };
+
+    // One counting sort pass on digit shift, from in to out; returns false,
+    // with nothing moved, if every key has the same digit
+    template <typename K>
+    bool sort_pass(const K* in, K* out, size_t n, int shift, size_t blocks,
+      std::vector<std::array<size_t, buckets>>& offsets) {
+      const size_t block = (n + blocks - 1) / blocks;
+
+      tbb::parallel_for(size_t(0), blocks, [=, &offsets](size_t b) {
+        std::array<size_t, buckets>& hist = offsets[b];
+        hist.fill(0);
+        size_t end = std::min(n, (b + 1) * block);
+        for (size_t i=b*block; i<end; ++i)
+          ++hist[(in[i] >> shift) & (buckets - 1)];
+      });
+
+      // Totals for each digit, and the start of each digit in the output
+      std::array<size_t, buckets> start;
+      tbb::parallel_for(size_t(0), buckets, [&](size_t d) {
+        size_t total = 0;
+        for (size_t b=0; b<blocks; ++b)
+          total += offsets[b][d];
+        start[d] = total;
+      });
+      size_t running = 0;
+      for (size_t d=0; d<buckets; ++d) {
+        if (start[d] == n)
+          return false;
+        size_t total = start[d];
+        start[d] = running;
+        running += total;
+      }
+      tbb::parallel_for(size_t(0), buckets, [&](size_t d) {
+        size_t offset = start[d];
+        for (size_t b=0; b<blocks; ++b) {
+          size_t count = offsets[b][d];
+          offsets[b][d] = offset;
+          offset += count;
+        }
+      });
+
+      tbb::parallel_for(size_t(0), blocks, [=, &offsets](size_t b) {
+        const size_t wc = combine<K>::size;
+        std::array<size_t, buckets>& offset = offsets[b];
+        std::vector<K> buffer(buckets * wc);
+        std::array<uint32_t, buckets> filled;
+        filled.fill(0);
+        size_t end = std::min(n, (b + 1) * block);
+        for (size_t i=b*block; i<end; ++i) {
+          K k = in[i];
+          size_t d = (k >> shift) & (buckets - 1);
+          buffer[d * wc + filled[d]] = k;
+          if (++filled[d] == wc) {
+            std::memcpy(out + offset[d], &buffer[d * wc], wc * sizeof(K));
+            offset[d] += wc;
+            filled[d] = 0;
+          }
+        }
+        for (size_t d=0; d<buckets; ++d)
+          std::memcpy(out + offset[d], &buffer[d * wc], filled[d] * sizeof(K));
+      });
+      return true;
+    }
+
+  } // namespace detail
+
+  // Sort the n unsigned keys; scratch is a buffer of n keys, and the
+  // sorted keys are in keys or scratch, as the return says
+  template <typename K>
+  K* sort_keys(K* keys, K* scratch, size_t n) {
+    static_assert(std::is_unsigned<K>::value, "radix::sort_keys sorts unsigned keys");
+    // A few blocks per thread for balance, but each at least 64K keys so
+    // the histograms and buffers pay for themselves
+    size_t blocks = std::max<size_t>(1, std::min<size_t>(
+      n / 65536, 4 * tbb::this_task_arena::max_concurrency()));
+    std::vector<std::array<size_t, detail::buckets>> offsets(blocks);
+
+    // Bits that differ between keys, from their AND and OR, so digits that
+    // are the same in every key don't even need a histogram
+    typedef std::pair<K, K> and_or;
+    and_or bits = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, n),
+      and_or(K(~K(0)), K(0)),
+      [=](const tbb::blocked_range<size_t>& r, and_or b) {
+        for (size_t i=r.begin(); i!=r.end(); ++i) {
+          b.first &= keys[i];
+          b.second |= keys[i];
+        }
+        return b;
+      },
+      [](and_or a, const and_or& b) {
+        return and_or(a.first & b.first, a.second | b.second);
+      });
+    const K varying = bits.first ^ bits.second;
+
+    K* in = keys;
+    K* out = scratch;
+    for (int shift=0; shift<int(8 * sizeof(K)); shift+=detail::radix_bits) {
+      if (((varying >> shift) & (detail::buckets - 1)) == 0)
+        continue;
+      if (detail::sort_pass(in, out, n, shift, blocks, offsets))
+        std::swap(in, out);
+    }
+    return in;
+  }
+
+  template <typename T>
+  void sort(T* data, size_t n) {
+    typedef key_traits<T> traits;
+    typedef typename traits::key K;
+    if (n < 2)
+      return;
+    // Left uninitialised, so the pages are first touched in parallel
+    std::unique_ptr<K[]> keys(new K[n]), scratch(new K[n]);
+    K* k = keys.get();
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, n),
+      [=](const tbb::blocked_range<size_t>& r) {
+        for (size_t i=r.begin(); i!=r.end(); ++i)
+          k[i] = traits::to_key(data[i]);
+      });
+    const K* sorted = sort_keys(keys.get(), scratch.get(), n);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, n),
+      [=](const tbb::blocked_range<size_t>& r) {
+        for (size_t i=r.begin(); i!=r.end(); ++i)
+          data[i] = traits::from_key(sorted[i]);
+      });
+  }
+
+  template <typename T>
+  void sort(std::vector<T>& data) {
+    sort(data.data(), data.size());
+  }
+
+} // namespace radix
+
+#endif  // RADIX_SORT_H
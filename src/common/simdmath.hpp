@@ -0,0 +1,460 @@
+// Vectorised transcendental maths for the tutorial's compute bound kernels
+//
+// Batch versions of log, exp, pow and sin, over arrays of doubles or floats.
+// The algorithms are the classic fdlibm ones (Cody-Waite argument reduction
+// plus minimax polynomials), written once with GCC vector extensions and
+// then compiled for several instruction sets. The best one supported by the
+// CPU is picked at runtime:
+//
+//   avx512 - 8 double lanes (needs AVX-512F)
+//   avx2   - 4 double lanes (needs AVX2 and FMA)
+//   sse4   - 2 double lanes (needs SSE4.1)
+//   scalar - 1 lane, used when none of the above are available
+//
+// Accuracy, as checked against long double libm by simdmath-accuracy in
+// 04-TBBLoops:
+//
+//   log(x)    <= 1 ulp for all finite x > 0
+//   exp(x)    <= 1 ulp for x in [-708, 709]
+//   sin(x)    <= 2.5 ulp for |x| < 1.6e6; larger arguments fall back
+//                 to std::sin
+//   pow(x, y) <= 1 + 1.5|y log(x)| ulp, as it is evaluated as exp(y*log(x)).
+//                 Negative x gives NaN, use std::pow for negative bases.
+//
+// The float versions are evaluated in double lanes and rounded once, so
+// they are correctly rounded in nearly all cases (<= 0.51 ulp).
+//
+// Special values follow the C library: log(0) is -inf, log(x<0) is NaN,
+// exp overflows to +inf and underflows to 0, NaN propagates.
+//
+// All functions accept in == out, i.e., they can work in place.
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#ifndef SIMD_MATH_H
+#define SIMD_MATH_H 1
+
+namespace simdmath {
+
+  enum class isa { scalar = 0, sse4 = 1, avx2 = 2, avx512 = 3 };
+
+  inline const char* isa_name(isa i) {
+    switch (i) {
+      case isa::avx512: return "avx512";
+      case isa::avx2: return "avx2";
+      case isa::sse4: return "sse4";
+      default: return "scalar";
+    }
+  }
+
+  namespace detail {
+
+    // The instruction set currently in use, -1 before detection. The
+    // first use is often inside a parallel body, so it is atomic; threads
+    // that detect at the same time all store the same value, so relaxed
+    // ordering is enough.
+    inline std::atomic<int>& active_isa() {
+      static std::atomic<int> active{-1};
+      return active;
+    }
+
+    inline isa detect_isa() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx512f"))
+        return isa::avx512;
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return isa::avx2;
+      if (__builtin_cpu_supports("sse4.1"))
+        return isa::sse4;
+#endif
+      return isa::scalar;
+    }
+
+    // Vector types for N double lanes, with matching 64 bit integer lanes
+    template <int N> struct vec {
+      typedef double d __attribute__((vector_size(N*8)));
+      typedef int64_t i __attribute__((vector_size(N*8)));
+    };
+
+#define SIMDMATH_INLINE inline __attribute__((always_inline))
+
+    // The helpers and kernels below never take or return a vector by value,
+    // the kernels work in place on their first argument instead. GCC notes
+    // the ABI of by-value vectors (-Wpsabi) in functions not compiled for
+    // the matching instruction set, and as these templates are instantiated
+    // at the end of the translation unit a pragma here couldn't silence it.
+    template <typename V> SIMDMATH_INLINE void load(const double* p, V& v) {
+      std::memcpy(&v, p, sizeof(V));
+    }
+
+    template <typename V> SIMDMATH_INLINE void store(double* p, const V& v) {
+      std::memcpy(p, &v, sizeof(V));
+    }
+
+    // Round to nearest integer value; valid for |x| < 2^51
+    template <typename V> SIMDMATH_INLINE void round(V& x) {
+      const double magic = 6755399441055744.0;
+      x = (x + magic) - magic;
+    }
+
+    // Integer lanes from a double holding an integer value, |x| < 2^51
+    template <typename V, typename I> SIMDMATH_INLINE void to_int(const V& x, I& n) {
+      const double magic = 6755399441055744.0;
+      n = (I)(x + magic) - (I)(V{} + magic);
+    }
+
+    // Double lanes from small integer lanes
+    template <typename V, typename I> SIMDMATH_INLINE void to_double(const I& n, V& x) {
+      const double magic = 6755399441055744.0;
+      x = (V)(n + (I)(V{} + magic)) - magic;
+    }
+
+    // 2^n for integer lanes n in [-1022, 1023]
+    template <typename V, typename I> SIMDMATH_INLINE void pow2(const I& n, V& x) {
+      x = (V)((n + 1023) << 52);
+    }
+
+    template <typename V, typename I> SIMDMATH_INLINE void exp(V& x) {
+      const double ln2_hi = 6.93147180369123816490e-01;
+      const double ln2_lo = 1.90821492927058770002e-10;
+      const double inv_ln2 = 1.44269504088896338700e+00;
+      // Clamp so the scale fits, beyond this the result is inf or 0
+      x = (x > 710.0) ? V{} + 710.0 : x;
+      x = (x < -746.0) ? V{} - 746.0 : x;
+      V n = x * inv_ln2;
+      round(n);
+      V r = (x - n * ln2_hi) - n * ln2_lo;
+      // Taylor series for exp(r), |r| <= ln2/2, truncation error < 2^-58
+      V p = V{} + 1.0/87178291200.0;
+      p = p * r + 1.0/6227020800.0;
+      p = p * r + 1.0/479001600.0;
+      p = p * r + 1.0/39916800.0;
+      p = p * r + 1.0/3628800.0;
+      p = p * r + 1.0/362880.0;
+      p = p * r + 1.0/40320.0;
+      p = p * r + 1.0/5040.0;
+      p = p * r + 1.0/720.0;
+      p = p * r + 1.0/120.0;
+      p = p * r + 1.0/24.0;
+      p = p * r + 1.0/6.0;
+      p = p * r + 0.5;
+      p = p * r * r + r + 1.0;
+      // Scale by 2^n in two steps, so that results near the limits of
+      // the exponent range are not lost
+      I k;
+      to_int(n, k);
+      I k1 = k >> 1;
+      V s1, s2;
+      pow2(k1, s1);
+      pow2(k - k1, s2);
+      x = p * s1 * s2;
+    }
+
+    template <typename V, typename I> SIMDMATH_INLINE void log(V& x) {
+      const double ln2_hi = 6.93147180369123816490e-01;
+      const double ln2_lo = 1.90821492927058770002e-10;
+      const double Lg1 = 6.666666666666735130e-01;
+      const double Lg2 = 3.999999999940941908e-01;
+      const double Lg3 = 2.857142874366239149e-01;
+      const double Lg4 = 2.222219843214978396e-01;
+      const double Lg5 = 1.818357216161805012e-01;
+      const double Lg6 = 1.531383769920937332e-01;
+      const double Lg7 = 1.479819860511658591e-01;
+
+      // Bring subnormals into the normal range
+      I tiny = x < 2.2250738585072014e-308;
+      V xs = tiny ? x * 18014398509481984.0 : x;
+      I bits = (I)xs;
+      I e = ((bits >> 52) & 0x7ff) - 1023 - (tiny & 54);
+      // Mantissa in [sqrt(2)/2, sqrt(2))
+      I mbits = (bits & 0x000fffffffffffffLL) | 0x3ff0000000000000LL;
+      V m = (V)mbits;
+      I big = m > 1.41421356237309504880;
+      m = big ? m * 0.5 : m;
+      e = e - big;  // big lanes are -1, so this adds one
+
+      V f = m - 1.0;
+      V s = f / (f + 2.0);
+      V z = s * s;
+      V w = z * z;
+      V t1 = w * (Lg2 + w * (Lg4 + w * Lg6));
+      V t2 = z * (Lg1 + w * (Lg3 + w * (Lg5 + w * Lg7)));
+      V R = t1 + t2;
+      V hfsq = 0.5 * f * f;
+      V dk;
+      to_double(e, dk);
+      V result = dk * ln2_hi - ((hfsq - (s * (hfsq + R) + dk * ln2_lo)) - f);
+
+      // Special cases; the NaN for x < 0 is the x86 default NaN, with the
+      // sign bit set, which is what the C library gives (and prints as -nan)
+      const double inf = __builtin_inf();
+      const double default_nan = -__builtin_nan("");
+      result = (x == 0.0) ? V{} - inf : result;
+      result = (x < 0.0) ? V{} + default_nan : result;
+      result = (x == inf) ? x : result;
+      x = (x != x) ? x : result;
+    }
+
+    template <typename V, typename I> SIMDMATH_INLINE void sin(V& x) {
+      const double two_over_pi = 6.36619772367581382433e-01;
+      const double pio2_1 = 1.57079632673412561417e+00;
+      const double pio2_2 = 6.07710050630396597660e-11;
+      const double pio2_3 = 2.02226624871116645580e-21;
+      const double S1 = -1.66666666666666324348e-01;
+      const double S2 = 8.33333333332248946124e-03;
+      const double S3 = -1.98412698298579493134e-04;
+      const double S4 = 2.75573137070700676789e-06;
+      const double S5 = -2.50507602534068634195e-08;
+      const double S6 = 1.58969099521155010221e-10;
+      const double C1 = 4.16666666666666019037e-02;
+      const double C2 = -1.38888888888741095749e-03;
+      const double C3 = 2.48015872894767294178e-05;
+      const double C4 = -2.75573143513906633035e-07;
+      const double C5 = 2.08757232129817482790e-09;
+      const double C6 = -1.13596475577881948265e-11;
+
+      // Cody-Waite reduction to y in [-pi/4, pi/4], exact for n < 2^20
+      V n = x * two_over_pi;
+      round(n);
+      V y = ((x - n * pio2_1) - n * pio2_2) - n * pio2_3;
+      I q;
+      to_int(n, q);
+
+      V z = y * y;
+      V s = y + y * z * (S1 + z * (S2 + z * (S3 + z * (S4 + z * (S5 + z * S6)))));
+      V r = z * (C1 + z * (C2 + z * (C3 + z * (C4 + z * (C5 + z * C6)))));
+      V hz = 0.5 * z;
+      V w = 1.0 - hz;
+      V c = w + (((1.0 - w) - hz) + z * r);
+
+      V result = (q & 1) ? c : s;
+      x = (q & 2) ? -result : result;
+    }
+
+    template <typename V, typename I> SIMDMATH_INLINE void pow(V& x, const V& y) {
+      V result = x;
+      log<V, I>(result);
+      result = y * result;
+      exp<V, I>(result);
+      const double inf = __builtin_inf();
+      V zero_pow = (y > 0.0) ? V{} : V{} + inf;
+      result = (x == 0.0) ? zero_pow : result;
+      result = (y == 0.0) ? V{} + 1.0 : result;
+      x = (x == 1.0) ? V{} + 1.0 : result;
+    }
+
+    // Loops that apply a kernel over whole arrays, N lanes at a time, with
+    // the tail handled by padding out a final partial vector
+#define SIMDMATH_UNARY_LOOP(N, KERNEL) \
+    { \
+      typedef typename vec<N>::d V; \
+      typedef typename vec<N>::i I; \
+      size_t i = 0; \
+      V v; \
+      for (; i + N <= n; i += N) { \
+        load(in + i, v); \
+        KERNEL<V, I>(v); \
+        store(out + i, v); \
+      } \
+      if (i < n) { \
+        double tmp[N]; \
+        for (size_t j = 0; j < N; ++j) tmp[j] = (i + j < n) ? in[i + j] : 1.0; \
+        load(tmp, v); \
+        KERNEL<V, I>(v); \
+        store(tmp, v); \
+        for (size_t j = 0; i + j < n; ++j) out[i + j] = tmp[j]; \
+      } \
+    }
+
+#define SIMDMATH_BINARY_LOOP(N, KERNEL) \
+    { \
+      typedef typename vec<N>::d V; \
+      typedef typename vec<N>::i I; \
+      size_t i = 0; \
+      V va, vb; \
+      for (; i + N <= n; i += N) { \
+        load(a + i, va); \
+        load(b + i, vb); \
+        KERNEL<V, I>(va, vb); \
+        store(out + i, va); \
+      } \
+      if (i < n) { \
+        double ta[N], tb[N]; \
+        for (size_t j = 0; j < N; ++j) { \
+          ta[j] = (i + j < n) ? a[i + j] : 1.0; \
+          tb[j] = (i + j < n) ? b[i + j] : 1.0; \
+        } \
+        load(ta, va); \
+        load(tb, vb); \
+        KERNEL<V, I>(va, vb); \
+        store(ta, va); \
+        for (size_t j = 0; i + j < n; ++j) out[i + j] = ta[j]; \
+      } \
+    }
+
+    // Instantiate one batch function per instruction set
+#define SIMDMATH_UNARY_ISA(NAME, KERNEL) \
+    inline void NAME##_scalar(const double* in, double* out, size_t n) SIMDMATH_UNARY_LOOP(1, KERNEL) \
+    __attribute__((target("sse4.1"))) \
+    inline void NAME##_sse4(const double* in, double* out, size_t n) SIMDMATH_UNARY_LOOP(2, KERNEL) \
+    __attribute__((target("avx2,fma"))) \
+    inline void NAME##_avx2(const double* in, double* out, size_t n) SIMDMATH_UNARY_LOOP(4, KERNEL) \
+    __attribute__((target("avx512f"))) \
+    inline void NAME##_avx512(const double* in, double* out, size_t n) SIMDMATH_UNARY_LOOP(8, KERNEL)
+
+#define SIMDMATH_BINARY_ISA(NAME, KERNEL) \
+    inline void NAME##_scalar(const double* a, const double* b, double* out, size_t n) SIMDMATH_BINARY_LOOP(1, KERNEL) \
+    __attribute__((target("sse4.1"))) \
+    inline void NAME##_sse4(const double* a, const double* b, double* out, size_t n) SIMDMATH_BINARY_LOOP(2, KERNEL) \
+    __attribute__((target("avx2,fma"))) \
+    inline void NAME##_avx2(const double* a, const double* b, double* out, size_t n) SIMDMATH_BINARY_LOOP(4, KERNEL) \
+    __attribute__((target("avx512f"))) \
+    inline void NAME##_avx512(const double* a, const double* b, double* out, size_t n) SIMDMATH_BINARY_LOOP(8, KERNEL)
+
+    SIMDMATH_UNARY_ISA(log, log)
+    SIMDMATH_UNARY_ISA(exp, exp)
+    SIMDMATH_UNARY_ISA(sin_reduced, sin)
+    SIMDMATH_BINARY_ISA(pow, pow)
+
+#undef SIMDMATH_UNARY_ISA
+#undef SIMDMATH_BINARY_ISA
+#undef SIMDMATH_UNARY_LOOP
+#undef SIMDMATH_BINARY_LOOP
+
+  } // namespace detail
+
+  // The instruction set used by the batch functions; detected on first
+  // use, or taken from the SIMDMATH_ISA environment variable (scalar, sse4,
+  // avx2 or avx512) if that is set and supported
+  inline isa active_isa() {
+    int active = detail::active_isa().load(std::memory_order_relaxed);
+    if (active < 0) {
+      isa best = detail::detect_isa();
+      active = int(best);
+      if (const char* env = std::getenv("SIMDMATH_ISA")) {
+        for (int i = 0; i <= int(best); ++i)
+          if (!std::strcmp(env, isa_name(isa(i))))
+            active = i;
+      }
+      detail::active_isa().store(active, std::memory_order_relaxed);
+    }
+    return isa(active);
+  }
+
+  // Limit the instruction set used, e.g., to compare the different
+  // paths; requests above what the CPU supports are capped
+  inline isa set_isa(isa requested) {
+    isa best = detail::detect_isa();
+    detail::active_isa().store(int(requested) < int(best) ? int(requested) : int(best),
+      std::memory_order_relaxed);
+    return active_isa();
+  }
+
+  // Number of lanes of the active instruction set for elements of type T,
+  // e.g., lanes<float>() is twice lanes() except for scalar code
+  template <typename T = double>
+  inline size_t lanes() {
+    if (active_isa() == isa::scalar)
+      return 1;
+    return (size_t(1) << int(active_isa())) * sizeof(double) / sizeof(T);
+  }
+
+#define SIMDMATH_DISPATCH(NAME, ...) \
+  switch (active_isa()) { \
+    case isa::avx512: detail::NAME##_avx512(__VA_ARGS__); break; \
+    case isa::avx2: detail::NAME##_avx2(__VA_ARGS__); break; \
+    case isa::sse4: detail::NAME##_sse4(__VA_ARGS__); break; \
+    default: detail::NAME##_scalar(__VA_ARGS__); \
+  }
+
+  inline void log(const double* in, double* out, size_t n) {
+    SIMDMATH_DISPATCH(log, in, out, n)
+  }
+
+  inline void exp(const double* in, double* out, size_t n) {
+    SIMDMATH_DISPATCH(exp, in, out, n)
+  }
+
+  inline void sin(const double* in, double* out, size_t n) {
+    // Arguments too large for the fast reduction go through libm; NaN
+    // and inf propagate to NaN through the reduction. The large arguments
+    // are saved before anything is written, as in may be out.
+    const double limit = 1.6e6;
+    std::vector<std::pair<size_t, double>> large;
+    for (size_t i = 0; i < n; ++i)
+      if (std::fabs(in[i]) > limit && std::isfinite(in[i]))
+        large.emplace_back(i, in[i]);
+    if (large.empty()) {
+      SIMDMATH_DISPATCH(sin_reduced, in, out, n)
+      return;
+    }
+    if (in != out)
+      std::memcpy(out, in, n * sizeof(double));
+    for (const auto& l: large)
+      out[l.first] = 0.0;
+    SIMDMATH_DISPATCH(sin_reduced, out, out, n)
+    for (const auto& l: large)
+      out[l.first] = std::sin(l.second);
+  }
+
+  inline void pow(const double* x, const double* y, double* out, size_t n) {
+    SIMDMATH_DISPATCH(pow, x, y, out, n)
+  }
+
+  // pow with a single exponent for all elements
+  inline void pow(const double* x, double y, double* out, size_t n) {
+    const size_t chunk = 256;
+    double ys[chunk];
+    for (size_t j = 0; j < chunk; ++j) ys[j] = y;
+    for (size_t i = 0; i < n; i += chunk) {
+      size_t m = (n - i < chunk) ? n - i : chunk;
+      SIMDMATH_DISPATCH(pow, x + i, ys, out + i, m)
+    }
+  }
+
+#undef SIMDMATH_DISPATCH
+
+  // Float versions, evaluated in double precision in chunks
+  namespace detail {
+    template <typename F>
+    inline void float_unary(const float* in, float* out, size_t n, F f) {
+      const size_t chunk = 256;
+      double tmp[chunk];
+      for (size_t i = 0; i < n; i += chunk) {
+        size_t m = (n - i < chunk) ? n - i : chunk;
+        for (size_t j = 0; j < m; ++j) tmp[j] = in[i + j];
+        f(tmp, tmp, m);
+        for (size_t j = 0; j < m; ++j) out[i + j] = float(tmp[j]);
+      }
+    }
+  }
+
+  inline void log(const float* in, float* out, size_t n) {
+    detail::float_unary(in, out, n, [](const double* a, double* b, size_t m) { log(a, b, m); });
+  }
+
+  inline void exp(const float* in, float* out, size_t n) {
+    detail::float_unary(in, out, n, [](const double* a, double* b, size_t m) { exp(a, b, m); });
+  }
+
+  inline void sin(const float* in, float* out, size_t n) {
+    detail::float_unary(in, out, n, [](const double* a, double* b, size_t m) { sin(a, b, m); });
+  }
+
+  inline void pow(const float* x, float y, float* out, size_t n) {
+    detail::float_unary(x, out, n, [y](const double* a, double* b, size_t m) { pow(a, double(y), b, m); });
+  }
+
+} // namespace simdmath
+
+#undef SIMDMATH_INLINE
+
+#endif // SIMD_MATH_H
@@ -28,7 +28,18 @@ void time_burn_for(float ms_interval) {
       << " took " << std::chrono::duration<float, std::milli> (duration).count() << "ms" << std::endl;
 }
 
+void time_spin_ns(double ns) {
+  auto start = std::chrono::steady_clock::now();
+  workload::spin_ns(ns);
+  auto stop = std::chrono::steady_clock::now();
+  std::cout << std::setprecision(5) << std::scientific
+      << "Calibrated spin of " << ns << "ns "
+      << " took " << std::chrono::duration<double, std::nano> (stop - start).count() << "ns" << std::endl;
+}
+
 int main(int argn, char *argv[]) {
+  workload::calibrate();
+
   // Get some calibration data on how much time our burner uses
   unsigned long iterations = 100'000'000lu;
   while (iterations >= 10) {
@@ -44,5 +55,14 @@ int main(int argn, char *argv[]) {
     duration /= 10.;
   }
 
+  // The calibrated spins never read the clock, so they stay close to
+  // the asked for time down to a few tens of nanoseconds
+  std::cout << "Work unit calibrated at " << workload::ns_per_unit() << "ns" << std::endl;
+  double ns = 1e8;
+  while (ns >= 10.0) {
+    time_spin_ns(ns);
+    ns /= 10.;
+  }
+
   return 0;
 }
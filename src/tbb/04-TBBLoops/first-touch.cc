@@ -0,0 +1,142 @@
+// Effect of page size and first touch on memory bound parallel loops
+//
+// first-touch [SIZE] [PASSES]
+//
+// An array of SIZE doubles (default 32M, i.e., 256MB) is made and filled
+// in each of these ways:
+//
+//   new[], serial         - as parallel-for-mutex did, set_x on one thread
+//   normal, parallel      - hugearray with 4KB pages, parallel_init
+//   transparent, serial   - hugearray with transparent huge pages, set_x
+//   transparent, parallel - hugearray with transparent huge pages,
+//                           parallel_init
+//   explicit, parallel    - hugearray with MAP_HUGETLB pages (which falls
+//                           back to transparent if none are reserved)
+//
+// then PASSES (default 5) passes of two memory bound loops are timed:
+//
+//   stream - x[i] = 0.5 x[i] + 1 over the array, bandwidth bound
+//   random - a sum of SIZE/8 elements at scattered positions, which is
+//            bound by cache and TLB misses, so it shows the page size most
+//
+// The parallel fill and all the loops use one affinity_partitioner, so a
+// thread works on the pages it first touched. The fill time includes the
+// page faults, which are far fewer with huge pages. On a single socket
+// machine first touch doesn't move pages; with several sockets the serial
+// fill puts every page next to one of them.
+
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "tbb/tbb.h"
+
+#include "hugearray.hpp"
+
+void set_x(double x[], size_t const n) {
+  for (size_t i=0; i<n; ++i)
+    x[i] = i+0.5;
+}
+
+void stream_pass(double* x, size_t n, tbb::affinity_partitioner& partitioner) {
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, n),
+    [x](const tbb::blocked_range<size_t>& r) {
+      for (size_t i=r.begin(); i!=r.end(); ++i)
+        x[i] = 0.5 * x[i] + 1.0;
+    }, partitioner);
+}
+
+// Visits n/8 elements, each block of the range jumping around the array
+double random_pass(const double* x, size_t n, tbb::affinity_partitioner& partitioner) {
+  const size_t reads = n / 8;
+  return tbb::parallel_reduce(tbb::blocked_range<size_t>(0, reads), 0.0,
+    [x, n](const tbb::blocked_range<size_t>& r, double sum) {
+      for (size_t i=r.begin(); i!=r.end(); ++i)
+        sum += x[(i * 2654435761u) % n];
+      return sum;
+    }, std::plus<double>(), partitioner);
+}
+
+// Time the fill and the passes over an array
+void run(const std::string& name, double* x, size_t n, bool parallel, size_t passes) {
+  tbb::affinity_partitioner partitioner;
+  tbb::tick_count t0 = tbb::tick_count::now();
+  if (parallel)
+    hugearray::parallel_init(x, n, [](size_t i) { return i+0.5; }, partitioner);
+  else
+    set_x(x, n);
+  double fill = (tbb::tick_count::now() - t0).seconds();
+
+  double stream_first = 0.0, stream_rest = 0.0, random_first = 0.0, random_rest = 0.0;
+  volatile double sink = 0.0;
+  for (size_t pass=0; pass<passes; ++pass) {
+    t0 = tbb::tick_count::now();
+    stream_pass(x, n, partitioner);
+    tbb::tick_count t1 = tbb::tick_count::now();
+    sink = sink + random_pass(x, n, partitioner);
+    tbb::tick_count t2 = tbb::tick_count::now();
+    (pass ? stream_rest : stream_first) += (t1 - t0).seconds();
+    (pass ? random_rest : random_first) += (t2 - t1).seconds();
+  }
+  if (passes > 1) {
+    stream_rest /= passes - 1;
+    random_rest /= passes - 1;
+  } else {
+    stream_rest = stream_first;
+    random_rest = random_first;
+  }
+
+  // The stream pass reads and writes every element, the random pass reads
+  // one eighth of them
+  std::cout << std::setw(32) << name << std::setprecision(4)
+      << std::setw(10) << fill
+      << std::setw(10) << stream_first
+      << std::setw(10) << 2.0 * n * sizeof(double) / stream_rest * 1e-9
+      << std::setw(10) << random_first
+      << std::setw(10) << random_rest / (n / 8) * 1e9
+      << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  size_t my_size = 32 << 20, passes = 5;
+  if (argc >= 2)
+    my_size = std::stoul(argv[1]);
+  if (argc >= 3)
+    passes = std::stoul(argv[2]);
+  if (my_size < 8 || passes == 0) {
+    std::cerr << "Need at least 8 elements and one pass" << std::endl;
+    return 1;
+  }
+
+  std::cout << "Array of " << my_size << " doubles, " << passes << " passes" << std::endl
+      << std::setw(32) << "" << std::setw(10) << "fill" << std::setw(10) << "stream"
+      << std::setw(10) << "stream" << std::setw(10) << "random"
+      << std::setw(10) << "random" << std::endl
+      << std::setw(32) << "" << std::setw(10) << "s" << std::setw(10) << "first s"
+      << std::setw(10) << "GB/s" << std::setw(10) << "first s"
+      << std::setw(10) << "ns/read" << std::endl;
+
+  {
+    std::unique_ptr<double[]> x(new double[my_size]);
+    run("new[], serial", x.get(), my_size, false, passes);
+  }
+
+  struct configuration {
+    hugearray::pages pages;
+    bool parallel;
+  };
+  for (auto c: {configuration{hugearray::pages::normal, true},
+    configuration{hugearray::pages::transparent, false},
+    configuration{hugearray::pages::transparent, true},
+    configuration{hugearray::pages::explicit_huge, true}}) {
+    hugearray::array<double> x(my_size, c.pages);
+    std::string name = std::string(hugearray::pages_name(x.pages_used())) +
+      (c.parallel ? ", parallel" : ", serial");
+    if (x.pages_used() != c.pages)
+      name += " (fallback)";
+    run(name, x.data(), my_size, c.parallel, passes);
+  }
+
+  return 0;
+}
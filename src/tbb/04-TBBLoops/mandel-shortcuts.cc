@@ -0,0 +1,80 @@
+// Measure the interior shortcuts of the Mandelbrot kernels, see mandel.hpp
+//
+// mandel-shortcuts [GRID SIZE] [MAX_ITER] [X Y SIZE] [SHORTCUTS]
+//
+// Renders the view (by default the whole set, 0 0 4) by brute force with
+// no shortcuts, then with each of bulb, period and all (or only with
+// SHORTCUTS, if given), and reports how many points each shortcut caught
+// and how many iterations it saved. Exits with 1 if any render differs
+// from the one without shortcuts.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <tbb/tbb.h>
+
+#include "mandel.hpp"
+#include "mandelgrid.hpp"
+#include "mandelms.hpp"
+
+int main(int argc, char* argv[]) {
+  mandel::view v{0.0, 0.0, 4.0, 1000};
+  unsigned int max_iter = 1000;
+  if (argc>=2)
+    v.resolution = std::stoul(argv[1]);
+  if (argc>=3)
+    max_iter = std::stoul(argv[2]);
+  if (argc>=6) {
+    v.centre_x = std::stod(argv[3]);
+    v.centre_y = std::stod(argv[4]);
+    v.size = std::stod(argv[5]);
+  }
+  std::vector<unsigned> modes{mandel::bulb_test, mandel::periodicity, mandel::all_shortcuts};
+  if (argc>=7) {
+    unsigned shortcuts;
+    if (!mandel::parse_shortcuts(argv[6], shortcuts)) {
+      std::cerr << "Unknown shortcuts " << argv[6] << ", use none, bulb, period or all" << std::endl;
+      return 1;
+    }
+    modes = {shortcuts};
+  }
+  std::cout << "Mandel on a grid of " << v.resolution << " centred at ("
+      << v.centre_x << "," << v.centre_y << ") side " << v.size
+      << ", max_iter " << max_iter << ", "
+      << simdmath::isa_name(simdmath::active_isa()) << std::endl;
+
+  mandel::count_grid reference(v.resolution, v.resolution), grid(v.resolution, v.resolution);
+  tbb::tick_count t0 = tbb::tick_count::now();
+  uint64_t reference_iterations = mandel::brute_force(reference, v, max_iter);
+  tbb::tick_count t1 = tbb::tick_count::now();
+  double reference_time = (t1-t0).seconds();
+  std::cout << "none: " << reference_time << "s, "
+      << reference_iterations << " iterations" << std::endl;
+
+  size_t failed = 0;
+  for (auto shortcuts: modes) {
+    mandel::shortcut_stats stats;
+    t0 = tbb::tick_count::now();
+    uint64_t iterations = mandel::brute_force(grid, v, max_iter, shortcuts, &stats);
+    t1 = tbb::tick_count::now();
+    double time = (t1-t0).seconds();
+
+    size_t mismatches = 0;
+    for (size_t i=0; i<v.resolution; ++i)
+      for (size_t j=0; j<v.resolution; ++j)
+        if (reference(i, j) != grid(i, j))
+          ++mismatches;
+    if (mismatches)
+      ++failed;
+
+    std::cout << mandel::shortcuts_name(shortcuts) << ": " << time << "s, "
+        << iterations << " iterations; "
+        << stats.bulb_points << " bulb points, "
+        << stats.periodic_points << " periodic points, "
+        << stats.iterations_skipped << " iterations skipped ("
+        << 100.0 * stats.iterations_skipped / reference_iterations << "%); speed-up "
+        << reference_time/time << ", points differing " << mismatches << std::endl;
+  }
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,120 @@
+// Deep zoom Mandelbrot sequence, rendered by perturbation, see mandelzoom.hpp
+//
+// mandel-zoom [GRID SIZE] [MAX_ITER] [X Y SIZE] [FRAMES END_SIZE] [IMAGE]
+//
+// X and Y are read in double-double precision, so give as many digits as
+// the zoom needs. FRAMES frames are rendered, zooming geometrically from
+// SIZE to END_SIZE. Frames are rendered in parallel, and each frame in
+// parallel over its tiles, with the same reference orbit for all of
+// them. If IMAGE is given (e.g., zoom.pgm) frame k is written to
+// zoom-000k.pgm (or .ppm for colour).
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <tbb/tbb.h>
+
+#include "ddmath.hpp"
+#include "mandelgrid.hpp"
+#include "mandelzoom.hpp"
+
+// Name of frame k's image, the number goes before the extension
+std::string frame_name(const std::string& image, size_t k) {
+  char number[16];
+  std::snprintf(number, sizeof(number), "-%04zu", k);
+  size_t dot = image.rfind('.');
+  if (dot == std::string::npos)
+    return image + number;
+  return image.substr(0, dot) + number + image.substr(dot);
+}
+
+struct frame_result {
+  double size;
+  double seconds;
+  size_t inside;
+  bool written;
+};
+
+int main(int argc, char* argv[]) {
+  mandel::zoom_view v{0.0, 0.0, 1e-13, 400};
+  ddmath::parse("-0.743643887037158704752191506114774", v.centre_x);
+  ddmath::parse("0.131825904205311970493132056385139", v.centre_y);
+  unsigned int max_iter = 5000;
+  size_t frames = 1;
+  double end_size = v.size;
+  std::string image;
+
+  if (argc>=2)
+    v.resolution = std::stoul(argv[1]);
+  if (argc>=3)
+    max_iter = std::stoul(argv[2]);
+  if (argc>=6) {
+    if (!ddmath::parse(argv[3], v.centre_x) || !ddmath::parse(argv[4], v.centre_y)) {
+      std::cerr << "Bad centre " << argv[3] << " " << argv[4] << std::endl;
+      return 1;
+    }
+    v.size = end_size = std::stod(argv[5]);
+  }
+  if (argc>=8) {
+    frames = std::stoul(argv[6]);
+    end_size = std::stod(argv[7]);
+  }
+  if (argc>=9)
+    image = argv[8];
+  if (frames == 0 || !(v.size > 0.0) || !(end_size > 0.0)) {
+    std::cerr << "Need at least one frame and positive sizes" << std::endl;
+    return 1;
+  }
+
+  std::cout << "Zooming on (" << ddmath::to_string(v.centre_x) << ", "
+      << ddmath::to_string(v.centre_y) << ")" << std::endl
+      << frames << " frames of " << v.resolution << "x" << v.resolution
+      << " from size " << v.size << " to " << end_size
+      << ", max_iter " << max_iter << ", "
+      << simdmath::isa_name(simdmath::active_isa()) << std::endl;
+
+  tbb::tick_count t0 = tbb::tick_count::now();
+  mandel::reference_orbit ref(v.centre_x, v.centre_y, max_iter);
+  tbb::tick_count t1 = tbb::tick_count::now();
+  std::cout << "Reference orbit of " << ref.size() - 1 << " iterations"
+      << (ref.bounded(max_iter) ? "" : " (centre escapes)")
+      << " took " << (t1-t0).seconds() << "s" << std::endl;
+
+  std::vector<frame_result> results(frames);
+  t0 = tbb::tick_count::now();
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, frames, 1),
+    [&](const tbb::blocked_range<size_t>& r) {
+      for (size_t k=r.begin(); k!=r.end(); ++k) {
+        tbb::tick_count f0 = tbb::tick_count::now();
+        mandel::zoom_view frame = v;
+        if (frames > 1)
+          frame.size = v.size * std::pow(end_size / v.size, double(k) / (frames - 1));
+        mandel::count_grid grid(frame.resolution, frame.resolution);
+        mandel::render_zoom(grid, frame, ref, max_iter);
+        size_t inside = 0;
+        for (size_t i=0; i<grid.height(); ++i)
+          inside += std::count(grid.row(i), grid.row(i) + grid.width(), max_iter);
+        bool written = image.empty() || mandel::write_image(grid, max_iter, frame_name(image, k));
+        tbb::tick_count f1 = tbb::tick_count::now();
+        results[k] = frame_result{frame.size, (f1-f0).seconds(), inside, written};
+      }
+    });
+  t1 = tbb::tick_count::now();
+
+  int status = 0;
+  for (size_t k=0; k<frames; ++k) {
+    std::cout << "Frame " << k << ": size " << results[k].size << ", "
+        << results[k].inside << " points inside, " << results[k].seconds << "s";
+    if (!image.empty())
+      std::cout << (results[k].written ? ", wrote " : ", FAILED to write ") << frame_name(image, k);
+    std::cout << std::endl;
+    if (!results[k].written)
+      status = 1;
+  }
+  std::cout << "All frames took " << (t1-t0).seconds() << "s" << std::endl;
+
+  return status;
+}
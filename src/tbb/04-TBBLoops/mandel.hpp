@@ -0,0 +1,380 @@
+// Escape time kernels for the Mandelbrot examples
+//
+// The escape count of a point c is the number of iterations of
+// z -> z*z + c (from z = 0) for which |z| stays <= 2, up to max_iter.
+// A point is taken to be in the set if its count is max_iter.
+//
+// escape_count() does one point at a time; escape_counts() does a batch
+// of points, several at once in SIMD lanes (4 with SSE4.1, 8 with AVX2
+// and 16 with AVX-512F). Each lane stops counting when its point escapes,
+// and the batch stops when every lane has escaped. The instruction set is
+// picked at runtime, the same way as for the simdmath functions (so
+// SIMDMATH_ISA=scalar|sse4|avx2|avx512 also overrides it here).
+//
+// Floating point contraction (i.e., FMA) is switched off for the kernels,
+// so every instruction set gives exactly the same counts.
+//
+// Points in the set are the expensive ones, as they run all max_iter
+// iterations. Two optional shortcuts, selected with bit flags, stop them
+// early:
+//  - bulb_test: points inside the main cardioid or the period 2 bulb are
+//    found analytically, and get max_iter without iterating at all
+//  - periodicity: Brent's cycle detection; z is saved at iterations
+//    1, 2, 4, 8, ... and if a later z is exactly equal to the saved one
+//    the orbit is a cycle, which can never escape, so the point gets
+//    max_iter at once. As the comparison is exact this never changes a
+//    count.
+// The shortcut_stats count how many points each shortcut caught and how
+// many iterations that saved.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <immintrin.h>
+
+#include "simdmath.hpp"
+
+#ifndef MANDEL_H
+#define MANDEL_H 1
+
+namespace mandel {
+
+  // Which kernel to run the escape time calculation with
+  enum class kernel {
+    complex,  // original one point at a time std::complex<float> loop
+    scalar,   // one point at a time, explicit real arithmetic
+    simd      // SIMD batches, best instruction set available
+  };
+
+  inline const char* kernel_name(kernel k) {
+    switch (k) {
+      case kernel::complex: return "complex";
+      case kernel::scalar: return "scalar";
+      default: return "simd";
+    }
+  }
+
+  // Parse a kernel name, returns false for an unknown name
+  inline bool parse_kernel(const std::string& name, kernel& k) {
+    for (auto candidate: {kernel::complex, kernel::scalar, kernel::simd}) {
+      if (name == kernel_name(candidate)) {
+        k = candidate;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Shortcut flags
+  const unsigned no_shortcuts = 0;
+  const unsigned bulb_test = 1;
+  const unsigned periodicity = 2;
+  const unsigned all_shortcuts = bulb_test | periodicity;
+
+  inline const char* shortcuts_name(unsigned shortcuts) {
+    switch (shortcuts & all_shortcuts) {
+      case bulb_test: return "bulb";
+      case periodicity: return "period";
+      case all_shortcuts: return "all";
+      default: return "none";
+    }
+  }
+
+  // Parse shortcuts (none, bulb, period or all), returns false for an
+  // unknown name
+  inline bool parse_shortcuts(const std::string& name, unsigned& shortcuts) {
+    for (unsigned candidate: {no_shortcuts, bulb_test, periodicity, all_shortcuts}) {
+      if (name == shortcuts_name(candidate)) {
+        shortcuts = candidate;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  struct shortcut_stats {
+    uint64_t bulb_points = 0;         // points caught by bulb_test
+    uint64_t periodic_points = 0;     // points caught by periodicity
+    uint64_t iterations_skipped = 0;  // iterations saved by both
+
+    shortcut_stats& operator+=(const shortcut_stats& other) {
+      bulb_points += other.bulb_points;
+      periodic_points += other.periodic_points;
+      iterations_skipped += other.iterations_skipped;
+      return *this;
+    }
+  };
+
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+
+  // True if c is inside the main cardioid or the period 2 bulb
+  inline bool in_bulbs(float cx, float cy) {
+    float xq = cx - 0.25f, y2 = cy * cy;
+    float q = xq * xq + y2;
+    if (q * (q + xq) <= 0.25f * y2)
+      return true;
+    float xb = cx + 1.0f;
+    return xb * xb + y2 <= 0.0625f;
+  }
+
+  inline unsigned escape_count(float cx, float cy, unsigned max_iter) {
+    float x = 0.0f, y = 0.0f, x2 = 0.0f, y2 = 0.0f;
+    for (unsigned iter=0; iter<max_iter; ++iter) {
+      y = 2.0f * x * y + cy;
+      x = x2 - y2 + cx;
+      x2 = x * x;
+      y2 = y * y;
+      if (!(x2 + y2 <= 4.0f))
+        return iter;
+    }
+    return max_iter;
+  }
+
+  inline unsigned escape_count(float cx, float cy, unsigned max_iter,
+    unsigned shortcuts, shortcut_stats& stats) {
+    if ((shortcuts & bulb_test) && in_bulbs(cx, cy)) {
+      ++stats.bulb_points;
+      stats.iterations_skipped += max_iter;
+      return max_iter;
+    }
+    if (!(shortcuts & periodicity))
+      return escape_count(cx, cy, max_iter);
+    float x = 0.0f, y = 0.0f, x2 = 0.0f, y2 = 0.0f;
+    float saved_x = 0.0f, saved_y = 0.0f;
+    unsigned next_save = 1;
+    for (unsigned iter=0; iter<max_iter; ++iter) {
+      y = 2.0f * x * y + cy;
+      x = x2 - y2 + cx;
+      x2 = x * x;
+      y2 = y * y;
+      if (!(x2 + y2 <= 4.0f))
+        return iter;
+      if (x == saved_x && y == saved_y) {
+        ++stats.periodic_points;
+        stats.iterations_skipped += max_iter - iter - 1;
+        return max_iter;
+      }
+      if (iter + 1 == next_save) {
+        saved_x = x;
+        saved_y = y;
+        next_save *= 2;
+      }
+    }
+    return max_iter;
+  }
+
+  namespace detail {
+
+    // Vector types for N float lanes, with matching 32 bit integer lanes
+    template <int N> struct vec {
+      typedef float f __attribute__((vector_size(N*4)));
+      typedef int32_t i __attribute__((vector_size(N*4)));
+    };
+
+    // These take and give back their vectors by reference: escape_lanes
+    // calls them outside the target functions it is inlined into, where
+    // GCC would note the ABI of by-value vectors (-Wpsabi)
+
+    // True if any lane is non-zero
+    __attribute__((target("sse4.1")))
+    inline bool any(const vec<4>::i& v) {
+      return !_mm_testz_si128((__m128i)v, (__m128i)v);
+    }
+
+    __attribute__((target("avx")))
+    inline bool any(const vec<8>::i& v) {
+      return !_mm256_testz_si256((__m256i)v, (__m256i)v);
+    }
+
+    __attribute__((target("avx512f")))
+    inline bool any(const vec<16>::i& v) {
+      return _mm512_test_epi32_mask((__m512i)v, (__m512i)v);
+    }
+
+    // All ones in eq in the lanes where a and b have the same bits; equal
+    // bits are equal values, so this is an exact comparison (GCC does not
+    // vectorise == on 16 lanes with only AVX-512F)
+    __attribute__((target("sse4.1")))
+    inline void same(const vec<4>::f& a, const vec<4>::f& b, vec<4>::i& eq) {
+      eq = (vec<4>::i)_mm_cmpeq_epi32((__m128i)a, (__m128i)b);
+    }
+
+    __attribute__((target("avx2")))
+    inline void same(const vec<8>::f& a, const vec<8>::f& b, vec<8>::i& eq) {
+      eq = (vec<8>::i)_mm256_cmpeq_epi32((__m256i)a, (__m256i)b);
+    }
+
+    __attribute__((target("avx512f")))
+    inline void same(const vec<16>::f& a, const vec<16>::f& b, vec<16>::i& eq) {
+      eq = (vec<16>::i)_mm512_maskz_set1_epi32(
+        _mm512_cmpeq_epi32_mask((__m512i)a, (__m512i)b), -1);
+    }
+
+    // Escape counts of N points, the same arithmetic as escape_count()
+    // in every lane. Active lanes are all ones, so subtracting the mask
+    // adds one to the count of every lane that has not escaped yet. With
+    // Periodic, lanes whose orbit has cycled stop too; all lanes are at
+    // the same iteration, so they share the save points.
+    template <int N, bool Periodic>
+    inline __attribute__((always_inline)) void escape_lanes(const float* cx_in,
+      const float* cy_in, unsigned max_iter, uint32_t* counts, shortcut_stats& stats) {
+      typedef typename vec<N>::f F;
+      typedef typename vec<N>::i I;
+      F cx, cy;
+      std::memcpy(&cx, cx_in, sizeof(F));
+      std::memcpy(&cy, cy_in, sizeof(F));
+      F x = F{}, y = F{}, x2 = F{}, y2 = F{};
+      F saved_x = F{}, saved_y = F{};
+      I count = I{}, active = I{} - 1, cycled = I{};
+      unsigned next_save = 1;
+      for (unsigned iter=0; iter<max_iter; ++iter) {
+        y = 2.0f * x * y + cy;
+        x = x2 - y2 + cx;
+        x2 = x * x;
+        y2 = y * y;
+        active &= (I)(x2 + y2 <= 4.0f);
+        if (Periodic) {
+          I same_x, same_y;
+          same(x, saved_x, same_x);
+          same(y, saved_y, same_y);
+          I now_cycled = active & same_x & same_y;
+          cycled |= now_cycled;
+          active &= ~now_cycled;
+        }
+        if (!any(active))
+          break;
+        count -= active;
+        if (Periodic && iter + 1 == next_save) {
+          saved_x = x;
+          saved_y = y;
+          next_save *= 2;
+        }
+      }
+      std::memcpy(counts, &count, sizeof(I));
+      if (Periodic) {
+        int32_t lane_cycled[N];
+        std::memcpy(lane_cycled, &cycled, sizeof(I));
+        for (int j = 0; j < N; ++j) {
+          if (lane_cycled[j]) {
+            // A lane that cycled at iteration k has a count of k
+            ++stats.periodic_points;
+            stats.iterations_skipped += max_iter - counts[j] - 1;
+            counts[j] = max_iter;
+          }
+        }
+      }
+    }
+
+    template <int N, bool Periodic>
+    inline __attribute__((always_inline)) void escape_batch(const float* cx,
+      const float* cy, size_t n, unsigned max_iter, uint32_t* counts, shortcut_stats& stats) {
+      size_t i = 0;
+      for (; i + N <= n; i += N)
+        escape_lanes<N, Periodic>(cx + i, cy + i, max_iter, counts + i, stats);
+      if (i < n) {
+        // Pad the last partial batch with points that escape at once
+        float tx[N], ty[N];
+        uint32_t tc[N];
+        for (size_t j = 0; j < N; ++j) {
+          tx[j] = (i + j < n) ? cx[i + j] : 4.0f;
+          ty[j] = (i + j < n) ? cy[i + j] : 4.0f;
+        }
+        escape_lanes<N, Periodic>(tx, ty, max_iter, tc, stats);
+        for (size_t j = 0; i + j < n; ++j)
+          counts[i + j] = tc[j];
+      }
+    }
+
+    inline void escape_batch_scalar(const float* cx, const float* cy, size_t n,
+      unsigned max_iter, uint32_t* counts, bool periodic, shortcut_stats& stats) {
+      unsigned shortcuts = periodic ? periodicity : no_shortcuts;
+      for (size_t i=0; i<n; ++i)
+        counts[i] = escape_count(cx[i], cy[i], max_iter, shortcuts, stats);
+    }
+
+    __attribute__((target("sse4.1"), flatten))
+    inline void escape_batch_sse4(const float* cx, const float* cy, size_t n,
+      unsigned max_iter, uint32_t* counts, bool periodic, shortcut_stats& stats) {
+      if (periodic)
+        escape_batch<4, true>(cx, cy, n, max_iter, counts, stats);
+      else
+        escape_batch<4, false>(cx, cy, n, max_iter, counts, stats);
+    }
+
+    __attribute__((target("avx2"), flatten))
+    inline void escape_batch_avx2(const float* cx, const float* cy, size_t n,
+      unsigned max_iter, uint32_t* counts, bool periodic, shortcut_stats& stats) {
+      if (periodic)
+        escape_batch<8, true>(cx, cy, n, max_iter, counts, stats);
+      else
+        escape_batch<8, false>(cx, cy, n, max_iter, counts, stats);
+    }
+
+    __attribute__((target("avx512f"), flatten))
+    inline void escape_batch_avx512(const float* cx, const float* cy, size_t n,
+      unsigned max_iter, uint32_t* counts, bool periodic, shortcut_stats& stats) {
+      if (periodic)
+        escape_batch<16, true>(cx, cy, n, max_iter, counts, stats);
+      else
+        escape_batch<16, false>(cx, cy, n, max_iter, counts, stats);
+    }
+
+    inline void escape_batch_isa(const float* cx, const float* cy, size_t n,
+      unsigned max_iter, uint32_t* counts, bool periodic, shortcut_stats& stats) {
+      switch (simdmath::active_isa()) {
+        case simdmath::isa::avx512: escape_batch_avx512(cx, cy, n, max_iter, counts, periodic, stats); break;
+        case simdmath::isa::avx2: escape_batch_avx2(cx, cy, n, max_iter, counts, periodic, stats); break;
+        case simdmath::isa::sse4: escape_batch_sse4(cx, cy, n, max_iter, counts, periodic, stats); break;
+        default: escape_batch_scalar(cx, cy, n, max_iter, counts, periodic, stats);
+      }
+    }
+
+  } // namespace detail
+
+#pragma GCC pop_options
+
+  // Escape counts for the n points (cx[i], cy[i]), with the given
+  // shortcuts, whose statistics are added to stats
+  inline void escape_counts(const float* cx, const float* cy, size_t n,
+    unsigned max_iter, uint32_t* counts, unsigned shortcuts, shortcut_stats& stats) {
+    bool periodic = shortcuts & periodicity;
+    if (!(shortcuts & bulb_test)) {
+      detail::escape_batch_isa(cx, cy, n, max_iter, counts, periodic, stats);
+      return;
+    }
+    // Fill in the points inside the bulbs, and pack the others together
+    // so that the SIMD lanes are not wasted on them
+    const size_t chunk = 256;
+    float tx[chunk], ty[chunk];
+    uint32_t tc[chunk], index[chunk];
+    for (size_t i0=0; i0<n; i0+=chunk) {
+      size_t m = 0, end = std::min(n, i0 + chunk);
+      for (size_t i=i0; i<end; ++i) {
+        if (in_bulbs(cx[i], cy[i])) {
+          counts[i] = max_iter;
+          ++stats.bulb_points;
+          stats.iterations_skipped += max_iter;
+        } else {
+          tx[m] = cx[i];
+          ty[m] = cy[i];
+          index[m++] = i;
+        }
+      }
+      detail::escape_batch_isa(tx, ty, m, max_iter, tc, periodic, stats);
+      for (size_t k=0; k<m; ++k)
+        counts[index[k]] = tc[k];
+    }
+  }
+
+  inline void escape_counts(const float* cx, const float* cy, size_t n,
+    unsigned max_iter, uint32_t* counts) {
+    shortcut_stats stats;
+    escape_counts(cx, cy, n, max_iter, counts, no_shortcuts, stats);
+  }
+
+} // namespace mandel
+
+#endif  // MANDEL_H
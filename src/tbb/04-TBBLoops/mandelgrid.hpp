@@ -0,0 +1,164 @@
+// Output grid and image writers for the Mandelbrot examples
+//
+// count_grid holds the iteration count of every point in one contiguous,
+// cache line aligned block. Each row's stride is padded to a whole number
+// of cache lines, and tiles() gives a blocked_range2d over rows and whole
+// cache lines of columns, so no two tiles ever write to the same line.
+//
+// write_image() writes the grid as a binary PGM (grey) or PPM (colour)
+// image, chosen by the file extension. Bands of rows are converted to
+// pixels in parallel and written straight to their place in the file
+// with pwrite, so even very large renders never need a second copy of
+// the whole image in memory.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <tbb/tbb.h>
+
+#ifndef MANDEL_GRID_H
+#define MANDEL_GRID_H 1
+
+namespace mandel {
+
+  const size_t cache_line = 64;
+
+  // The square of the complex plane covered by a grid of resolution
+  // points a side. Grid row i is the real axis, column j the imaginary.
+  struct view {
+    double centre_x;
+    double centre_y;
+    double size;
+    size_t resolution;
+
+    float cx(size_t i) const {
+      return double(i)/resolution * size + (centre_x - size/2);
+    }
+
+    float cy(size_t j) const {
+      return double(j)/resolution * size + (centre_y - size/2);
+    }
+  };
+
+  class count_grid {
+  private:
+    size_t m_width;
+    size_t m_height;
+    size_t m_stride;
+    std::unique_ptr<uint32_t, decltype(&std::free)> m_counts;
+
+  public:
+    // Counts per cache line, the column granularity of tiles()
+    static const size_t line_counts = cache_line / sizeof(uint32_t);
+
+    count_grid(size_t width, size_t height):
+      m_width{width}, m_height{height},
+      m_stride{(width + line_counts - 1) / line_counts * line_counts},
+      m_counts{nullptr, &std::free}
+    {
+      void* p = nullptr;
+      if (posix_memalign(&p, cache_line, std::max<size_t>(1, m_stride * m_height) * sizeof(uint32_t)))
+        throw std::bad_alloc();
+      m_counts.reset(static_cast<uint32_t*>(p));
+    };
+
+    size_t width() const { return m_width; }
+    size_t height() const { return m_height; }
+    size_t stride() const { return m_stride; }
+
+    uint32_t* row(size_t i) { return m_counts.get() + i * m_stride; }
+    const uint32_t* row(size_t i) const { return m_counts.get() + i * m_stride; }
+
+    uint32_t& operator()(size_t i, size_t j) { return row(i)[j]; }
+    uint32_t operator()(size_t i, size_t j) const { return row(i)[j]; }
+
+    // Rows by whole cache lines of columns, use column_begin() and
+    // column_end() to get the column range of a tile
+    tbb::blocked_range2d<size_t> tiles(size_t row_grain = 1, size_t line_grain = 1) const {
+      return tbb::blocked_range2d<size_t>(0, m_height, row_grain,
+        0, m_stride / line_counts, line_grain);
+    }
+
+    // First and one past last column of a range of cache lines
+    size_t column_begin(const tbb::blocked_range<size_t>& lines) const {
+      return std::min(m_width, lines.begin() * line_counts);
+    }
+
+    size_t column_end(const tbb::blocked_range<size_t>& lines) const {
+      return std::min(m_width, lines.end() * line_counts);
+    }
+  };
+
+
+  // Pixel values: points in the set are black, outside points get
+  // brighter the longer they took to escape
+  inline uint8_t grey_value(uint32_t count, uint32_t max_iter) {
+    if (count >= max_iter)
+      return 0;
+    return 255 - uint8_t(255.0 * count / max_iter);
+  }
+
+  inline void colour_value(uint32_t count, uint32_t max_iter, uint8_t* rgb) {
+    if (count >= max_iter) {
+      rgb[0] = rgb[1] = rgb[2] = 0;
+      return;
+    }
+    // Bernstein polynomial palette, dark blue through to yellow
+    double t = double(count) / max_iter;
+    rgb[0] = uint8_t(9 * (1-t) * t*t*t * 255);
+    rgb[1] = uint8_t(15 * (1-t)*(1-t) * t*t * 255);
+    rgb[2] = uint8_t(8.5 * (1-t)*(1-t)*(1-t) * t * 255);
+  }
+
+  // Write the grid as an image, a .ppm file name gives a colour image,
+  // anything else a grey PGM. Rows of the grid are the image x axis, as
+  // for the text maps. Returns false on failure.
+  inline bool write_image(const count_grid& grid, uint32_t max_iter, const std::string& fname) {
+    bool colour = fname.size() >= 4 && fname.compare(fname.size()-4, 4, ".ppm") == 0;
+    const size_t channels = colour ? 3 : 1;
+    const size_t width = grid.height(), height = grid.width();
+    std::string header = std::string(colour ? "P6\n" : "P5\n") +
+      std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+
+    int fd = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      return false;
+    std::atomic<bool> ok{::pwrite(fd, header.data(), header.size(), 0) == ssize_t(header.size())};
+
+    // Each band of image rows (grid columns) is made and written separately
+    const size_t band_rows = std::max<size_t>(1, (1 << 20) / (width * channels));
+    tbb::enumerable_thread_specific<std::vector<uint8_t>> band_buffers;
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, height, band_rows),
+      [&](const tbb::blocked_range<size_t>& band) {
+        auto& pixels = band_buffers.local();
+        pixels.resize(band.size() * width * channels);
+        uint8_t* p = pixels.data();
+        for (size_t y=band.begin(); y!=band.end(); ++y) {
+          for (size_t x=0; x<width; ++x, p+=channels) {
+            if (colour)
+              colour_value(grid(x, y), max_iter, p);
+            else
+              *p = grey_value(grid(x, y), max_iter);
+          }
+        }
+        off_t offset = header.size() + band.begin() * width * channels;
+        if (::pwrite(fd, pixels.data(), pixels.size(), offset) != ssize_t(pixels.size()))
+          ok = false;
+      });
+    if (::close(fd))
+      ok = false;
+    return ok;
+  }
+
+} // namespace mandel
+
+#endif  // MANDEL_GRID_H
@@ -0,0 +1,309 @@
+// Deep zoom Mandelbrot rendering by perturbation
+//
+// In float (or double) the points of a view smaller than about 1e-5 (or
+// 1e-13) can't even be told apart. Rather than iterating every point in
+// high precision, one reference orbit Z_n of the view's centre C is
+// iterated in double-double (see ddmath.hpp) and stored as doubles. A
+// point C + dc then only needs its difference from the reference,
+// z_n = Z_n + dz_n, which obeys
+//
+//   dz_{n+1} = (2 Z_n + dz_n) dz_n + dc
+//
+// and is small, so plain double arithmetic is enough for it: the cost per
+// point is about that of the plain kernels, at any depth down to the
+// precision of the reference (about 1e-30).
+//
+// When |z_n| < |dz_n|, or the reference orbit runs out (the centre escaped
+// first), dz has lost precision relative to z, so the point is rebased
+// onto the start of the reference orbit: dz = z_n, n = 0 (Z_0 is 0). This
+// avoids the "glitches" of plain perturbation without needing a second
+// reference.
+//
+// Like escape_counts(), perturbed_counts() works on batches of points in
+// SIMD lanes (2 doubles with SSE4.1, 4 with AVX2 and 8 with AVX-512F),
+// picked at runtime. After rebasing, lanes are at different places in the
+// reference orbit, so each lane gathers its own Z_n.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <immintrin.h>
+
+#include <tbb/tbb.h>
+
+#include "ddmath.hpp"
+#include "mandel.hpp"
+#include "mandelgrid.hpp"
+
+#ifndef MANDEL_ZOOM_H
+#define MANDEL_ZOOM_H 1
+
+namespace mandel {
+
+  // A square of side size around a double-double centre; grid row i is
+  // the real axis, column j the imaginary, as for view
+  struct zoom_view {
+    ddmath::dd centre_x;
+    ddmath::dd centre_y;
+    double size;
+    size_t resolution;
+
+    // Offsets of grid points from the centre
+    double dcx(size_t i) const {
+      return (double(i)/resolution - 0.5) * size;
+    }
+
+    double dcy(size_t j) const {
+      return (double(j)/resolution - 0.5) * size;
+    }
+  };
+
+  // The orbit Z_0 = 0, Z_{n+1} = Z_n^2 + C, up to max_iter or until it
+  // escapes, whichever is first
+  class reference_orbit {
+  private:
+    std::vector<double> m_x;
+    std::vector<double> m_y;
+
+  public:
+    reference_orbit(const ddmath::dd& cx, const ddmath::dd& cy, unsigned max_iter) {
+      ddmath::dd x(0.0), y(0.0);
+      m_x.reserve(max_iter + 1);
+      m_y.reserve(max_iter + 1);
+      m_x.push_back(0.0);
+      m_y.push_back(0.0);
+      for (unsigned iter=0; iter<max_iter; ++iter) {
+        ddmath::dd x2 = ddmath::sqr(x), y2 = ddmath::sqr(y);
+        y = ddmath::dd(2.0) * x * y + cy;
+        x = x2 - y2 + cx;
+        m_x.push_back(double(x));
+        m_y.push_back(double(y));
+        if (m_x.back() * m_x.back() + m_y.back() * m_y.back() > 4.0)
+          break;
+      }
+    };
+
+    // Number of points in the orbit, at least 2
+    size_t size() const { return m_x.size(); }
+
+    const double* x() const { return m_x.data(); }
+    const double* y() const { return m_y.data(); }
+
+    // True if the centre did not escape
+    bool bounded(unsigned max_iter) const { return size() == max_iter + 1; }
+  };
+
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+
+  inline unsigned perturbed_count(const reference_orbit& ref, double dcx, double dcy,
+    unsigned max_iter) {
+    const double* ref_x = ref.x();
+    const double* ref_y = ref.y();
+    const size_t last = ref.size() - 1;
+    double dzx = 0.0, dzy = 0.0, zx_ref = 0.0, zy_ref = 0.0;
+    size_t n = 0;
+    for (unsigned iter=0; iter<max_iter; ++iter) {
+      double tx = 2.0 * zx_ref + dzx, ty = 2.0 * zy_ref + dzy;
+      double new_dzx = tx * dzx - ty * dzy + dcx;
+      dzy = tx * dzy + ty * dzx + dcy;
+      dzx = new_dzx;
+      ++n;
+      zx_ref = ref_x[n];
+      zy_ref = ref_y[n];
+      double zx = zx_ref + dzx, zy = zy_ref + dzy;
+      double r2 = zx * zx + zy * zy;
+      if (!(r2 <= 4.0))
+        return iter;
+      if (r2 < dzx * dzx + dzy * dzy || n == last) {
+        dzx = zx;
+        dzy = zy;
+        zx_ref = zy_ref = 0.0;
+        n = 0;
+      }
+    }
+    return max_iter;
+  }
+
+  namespace detail {
+
+    // Vector types for N double lanes, with matching 64 bit integer lanes
+    template <int N> struct dvec {
+      typedef double d __attribute__((vector_size(N*8)));
+      typedef int64_t l __attribute__((vector_size(N*8)));
+    };
+
+    // As in mandel.hpp, the helpers take and give back their vectors by
+    // reference, as GCC would note the ABI of by-value vectors (-Wpsabi)
+
+    // Lanes of base[index] in out
+    __attribute__((target("sse4.1")))
+    inline void gather(const double* base, const dvec<2>::l& index, dvec<2>::d& out) {
+      out = dvec<2>::d{base[index[0]], base[index[1]]};
+    }
+
+    __attribute__((target("avx2")))
+    inline void gather(const double* base, const dvec<4>::l& index, dvec<4>::d& out) {
+      out = (dvec<4>::d)_mm256_i64gather_pd(base, (__m256i)index, 8);
+    }
+
+    __attribute__((target("avx512f")))
+    inline void gather(const double* base, const dvec<8>::l& index, dvec<8>::d& out) {
+      out = (dvec<8>::d)_mm512_mask_i64gather_pd(_mm512_setzero_pd(), 0xff,
+        (__m512i)index, base, 8);
+    }
+
+    // All ones in eq in the lanes where a == b
+    __attribute__((target("sse4.1")))
+    inline void equal(const dvec<2>::l& a, const dvec<2>::l& b, dvec<2>::l& eq) {
+      eq = (dvec<2>::l)_mm_cmpeq_epi64((__m128i)a, (__m128i)b);
+    }
+
+    __attribute__((target("avx2")))
+    inline void equal(const dvec<4>::l& a, const dvec<4>::l& b, dvec<4>::l& eq) {
+      eq = (dvec<4>::l)_mm256_cmpeq_epi64((__m256i)a, (__m256i)b);
+    }
+
+    __attribute__((target("avx512f")))
+    inline void equal(const dvec<8>::l& a, const dvec<8>::l& b, dvec<8>::l& eq) {
+      eq = (dvec<8>::l)_mm512_maskz_set1_epi64(
+        _mm512_cmpeq_epi64_mask((__m512i)a, (__m512i)b), -1);
+    }
+
+    // Replace the lanes of b where mask is set by those of a
+    template <typename D, typename L>
+    inline __attribute__((always_inline)) void select(const L& mask, const D& a, D& b) {
+      b = (D)((mask & (L)a) | (~mask & (L)b));
+    }
+
+    // perturbed_count() for N points, as escape_lanes() does for
+    // escape_count()
+    template <int N>
+    inline __attribute__((always_inline)) void perturbed_lanes(const reference_orbit& ref,
+      const double* dcx_in, const double* dcy_in, unsigned max_iter, uint32_t* counts) {
+      typedef typename dvec<N>::d D;
+      typedef typename dvec<N>::l L;
+      typedef typename vec<2*N>::i I;
+      const double* ref_x = ref.x();
+      const double* ref_y = ref.y();
+      const L last = L{} + int64_t(ref.size() - 1);
+      D dcx, dcy;
+      std::memcpy(&dcx, dcx_in, sizeof(D));
+      std::memcpy(&dcy, dcy_in, sizeof(D));
+      D dzx = D{}, dzy = D{}, zx_ref = D{}, zy_ref = D{};
+      L n = L{}, count = L{}, active = L{} - 1;
+      for (unsigned iter=0; iter<max_iter; ++iter) {
+        D tx = 2.0 * zx_ref + dzx, ty = 2.0 * zy_ref + dzy;
+        D new_dzx = tx * dzx - ty * dzy + dcx;
+        dzy = tx * dzy + ty * dzx + dcy;
+        dzx = new_dzx;
+        n += 1;
+        gather(ref_x, n, zx_ref);
+        gather(ref_y, n, zy_ref);
+        D zx = zx_ref + dzx, zy = zy_ref + dzy;
+        D r2 = zx * zx + zy * zy;
+        active &= (L)(r2 <= 4.0);
+        if (!any((I)active))
+          break;
+        count -= active;
+        // Escaped lanes carry on harmlessly, rebasing keeps n in range
+        L at_last;
+        equal(n, last, at_last);
+        L rebase = (L)(r2 < dzx * dzx + dzy * dzy) | at_last;
+        select(rebase, zx, dzx);
+        select(rebase, zy, dzy);
+        select(rebase, D{}, zx_ref);
+        select(rebase, D{}, zy_ref);
+        select(rebase, L{}, n);
+      }
+      for (int j = 0; j < N; ++j)
+        counts[j] = count[j];
+    }
+
+    template <int N>
+    inline __attribute__((always_inline)) void perturbed_batch(const reference_orbit& ref,
+      const double* dcx, const double* dcy, size_t n, unsigned max_iter, uint32_t* counts) {
+      size_t i = 0;
+      for (; i + N <= n; i += N)
+        perturbed_lanes<N>(ref, dcx + i, dcy + i, max_iter, counts + i);
+      if (i < n) {
+        // Pad the last partial batch with points that escape at once
+        double tx[N], ty[N];
+        uint32_t tc[N];
+        for (size_t j = 0; j < N; ++j) {
+          tx[j] = (i + j < n) ? dcx[i + j] : 4.0;
+          ty[j] = (i + j < n) ? dcy[i + j] : 4.0;
+        }
+        perturbed_lanes<N>(ref, tx, ty, max_iter, tc);
+        for (size_t j = 0; i + j < n; ++j)
+          counts[i + j] = tc[j];
+      }
+    }
+
+    inline void perturbed_batch_scalar(const reference_orbit& ref, const double* dcx,
+      const double* dcy, size_t n, unsigned max_iter, uint32_t* counts) {
+      for (size_t i=0; i<n; ++i)
+        counts[i] = perturbed_count(ref, dcx[i], dcy[i], max_iter);
+    }
+
+    __attribute__((target("sse4.1"), flatten))
+    inline void perturbed_batch_sse4(const reference_orbit& ref, const double* dcx,
+      const double* dcy, size_t n, unsigned max_iter, uint32_t* counts) {
+      perturbed_batch<2>(ref, dcx, dcy, n, max_iter, counts);
+    }
+
+    __attribute__((target("avx2"), flatten))
+    inline void perturbed_batch_avx2(const reference_orbit& ref, const double* dcx,
+      const double* dcy, size_t n, unsigned max_iter, uint32_t* counts) {
+      perturbed_batch<4>(ref, dcx, dcy, n, max_iter, counts);
+    }
+
+    __attribute__((target("avx512f"), flatten))
+    inline void perturbed_batch_avx512(const reference_orbit& ref, const double* dcx,
+      const double* dcy, size_t n, unsigned max_iter, uint32_t* counts) {
+      perturbed_batch<8>(ref, dcx, dcy, n, max_iter, counts);
+    }
+
+  } // namespace detail
+
+#pragma GCC pop_options
+
+  // Escape counts of the n points (C + dcx[i], C + dcy[i]), where C is
+  // the centre of the reference orbit
+  inline void perturbed_counts(const reference_orbit& ref, const double* dcx,
+    const double* dcy, size_t n, unsigned max_iter, uint32_t* counts) {
+    switch (simdmath::active_isa()) {
+      case simdmath::isa::avx512: detail::perturbed_batch_avx512(ref, dcx, dcy, n, max_iter, counts); break;
+      case simdmath::isa::avx2: detail::perturbed_batch_avx2(ref, dcx, dcy, n, max_iter, counts); break;
+      case simdmath::isa::sse4: detail::perturbed_batch_sse4(ref, dcx, dcy, n, max_iter, counts); break;
+      default: detail::perturbed_batch_scalar(ref, dcx, dcy, n, max_iter, counts);
+    }
+  }
+
+  // Render the view into grid, in parallel over the grid's tiles; the
+  // reference orbit must be for the view's centre
+  inline void render_zoom(count_grid& grid, const zoom_view& v,
+    const reference_orbit& ref, unsigned max_iter) {
+    tbb::parallel_for(grid.tiles(), [&](const tbb::blocked_range2d<size_t>& r) {
+      const size_t chunk = 256;
+      double dcx[chunk], dcy[chunk];
+      size_t j_begin = grid.column_begin(r.cols()), j_end = grid.column_end(r.cols());
+      for (size_t i=r.rows().begin(); i!=r.rows().end(); ++i) {
+        for (size_t jc=j_begin; jc<j_end; jc+=chunk) {
+          size_t n = std::min(chunk, j_end - jc);
+          for (size_t j=0; j<n; ++j) {
+            dcx[j] = v.dcx(i);
+            dcy[j] = v.dcy(jc+j);
+          }
+          perturbed_counts(ref, dcx, dcy, n, max_iter, grid.row(i) + jc);
+        }
+      }
+    });
+  }
+
+} // namespace mandel
+
+#endif  // MANDEL_ZOOM_H
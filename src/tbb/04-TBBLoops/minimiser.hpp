@@ -0,0 +1,366 @@
+// Parallel global minimisation in a box
+//
+// A brute force grid search (as MinIndexF in parallel-minimisation.cc)
+// ties precision to cost: every extra digit needs ten times the points
+// (per dimension). Instead minimise() does:
+//
+//  1. A coarse grid over the box, evaluated in parallel in batches, then a
+//     parallel_reduce (in the style of MinIndexF) for the best K grid
+//     points that are local minima of the grid, i.e., no lower than any
+//     of their neighbours along each axis.
+//  2. In parallel, a local refinement from each of those K starts: Brent's
+//     method (golden section plus parabolic steps) in 1D, and Powell's
+//     conjugate direction method with Brent line searches in N-D.
+//
+// The objective is evaluated in batches: it is given n points (each of
+// dim doubles, one after another) and fills in n values, so it can use
+// SIMD over the points, e.g., with the simdmath functions. pointwise()
+// makes a batch objective out of a plain function of one point.
+//
+// Precision: the refinement stops when the search interval is below
+// tolerance (relative to |x|, plus tolerance absolute). Near a smooth
+// minimum f only changes as (x - x_min)^2, so values can only locate
+// x_min to about sqrt(machine epsilon) ~ 1e-8 relative; f(x_min) itself
+// is then found to double precision.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "tbb/tbb.h"
+
+#ifndef MINIMISER_H
+#define MINIMISER_H 1
+
+namespace minimise {
+
+  // Evaluate f at the n points x[0..dim), x[dim..2*dim), ...
+  typedef std::function<void(const double* x, size_t n, double* f)> objective;
+
+  template <typename F>
+  objective pointwise(size_t dim, F f) {
+    return [dim, f](const double* x, size_t n, double* values) {
+      for (size_t i=0; i<n; ++i)
+        values[i] = f(x + i * dim);
+    };
+  }
+
+  struct box {
+    std::vector<double> lo;
+    std::vector<double> hi;
+
+    size_t dim() const { return lo.size(); }
+  };
+
+  struct options {
+    size_t grid_points = 10000;   // total points in the coarse grid
+    size_t candidates = 8;        // starts for the refinement
+    double tolerance = 1e-12;     // refinement stopping interval
+    size_t max_iterations = 200;  // per Brent search or Powell pass
+    size_t batch = 256;           // points per objective call on the grid
+  };
+
+  struct minimum {
+    std::vector<double> x;
+    double value;
+  };
+
+  struct result {
+    std::vector<minimum> minima;  // distinct minima found, best first
+    size_t evaluations;
+  };
+
+  namespace detail {
+
+    // The best K (value, grid index) pairs, a parallel_reduce body
+    class best_candidates {
+    private:
+      const std::vector<double>* my_values;
+      const std::vector<size_t>* my_points;
+      const std::vector<size_t>* my_strides;
+      size_t my_k;
+
+      bool local_minimum(size_t i) const {
+        const std::vector<double>& values = *my_values;
+        double v = values[i];
+        size_t rest = i;
+        for (size_t d=my_strides->size(); d-->0; ) {
+          size_t stride = (*my_strides)[d];
+          size_t c = rest / stride;
+          rest %= stride;
+          if (c > 0 && values[i - stride] < v)
+            return false;
+          if (c + 1 < (*my_points)[d] && values[i + stride] < v)
+            return false;
+        }
+        return true;
+      }
+
+      void offer(double value, size_t index) {
+        if (best.size() == my_k && !(value < best.back().first))
+          return;
+        auto pos = std::upper_bound(best.begin(), best.end(), std::make_pair(value, index));
+        best.insert(pos, std::make_pair(value, index));
+        if (best.size() > my_k)
+          best.pop_back();
+      }
+
+    public:
+      std::vector<std::pair<double, size_t>> best;
+
+      void operator()(const tbb::blocked_range<size_t>& r) {
+        for (size_t i=r.begin(); i!=r.end(); ++i)
+          if (local_minimum(i))
+            offer((*my_values)[i], i);
+      }
+
+      best_candidates(best_candidates& b, tbb::split):
+        my_values{b.my_values}, my_points{b.my_points},
+        my_strides{b.my_strides}, my_k{b.my_k} {}
+
+      void join(const best_candidates& b) {
+        for (auto& c: b.best)
+          offer(c.first, c.second);
+      }
+
+      best_candidates(const std::vector<double>& values, const std::vector<size_t>& points,
+        const std::vector<size_t>& strides, size_t k):
+        my_values{&values}, my_points{&points}, my_strides{&strides}, my_k{k} {}
+    };
+
+    // Brent's method for the minimum of g in [a, b]; returns the position,
+    // with g's value there in g_min
+    template <typename G>
+    double brent(G g, double a, double b, double tol, size_t max_iter, double& g_min) {
+      const double golden = 0.3819660112501051;
+      double x = a + golden * (b - a), w = x, v = x;
+      double fx = g(x), fw = fx, fv = fx;
+      double d = 0.0, e = 0.0;
+      for (size_t iter=0; iter<max_iter; ++iter) {
+        double xm = 0.5 * (a + b);
+        double tol1 = tol * std::abs(x) + tol, tol2 = 2.0 * tol1;
+        if (std::abs(x - xm) <= tol2 - 0.5 * (b - a))
+          break;
+        bool golden_step = true;
+        if (std::abs(e) > tol1) {
+          // Try a parabola through x, w and v
+          double r = (x - w) * (fx - fv);
+          double q = (x - v) * (fx - fw);
+          double p = (x - v) * q - (x - w) * r;
+          q = 2.0 * (q - r);
+          if (q > 0.0)
+            p = -p;
+          q = std::abs(q);
+          double e_old = e;
+          e = d;
+          if (std::abs(p) < std::abs(0.5 * q * e_old) && p > q * (a - x) && p < q * (b - x)) {
+            d = p / q;
+            double u = x + d;
+            if (u - a < tol2 || b - u < tol2)
+              d = std::copysign(tol1, xm - x);
+            golden_step = false;
+          }
+        }
+        if (golden_step) {
+          e = (x >= xm) ? a - x : b - x;
+          d = golden * e;
+        }
+        double u = (std::abs(d) >= tol1) ? x + d : x + std::copysign(tol1, d);
+        double fu = g(u);
+        if (fu <= fx) {
+          if (u >= x)
+            a = x;
+          else
+            b = x;
+          v = w; fv = fw;
+          w = x; fw = fx;
+          x = u; fx = fu;
+        } else {
+          if (u < x)
+            a = u;
+          else
+            b = u;
+          if (fu <= fw || w == x) {
+            v = w; fv = fw;
+            w = u; fw = fu;
+          } else if (fu <= fv || v == x || v == w) {
+            v = u; fv = fu;
+          }
+        }
+      }
+      g_min = fx;
+      return x;
+    }
+
+    // Range of t for which x + t*d stays in the box, also limited to
+    // |t| <= reach
+    inline void line_range(const box& b, const std::vector<double>& x,
+      const std::vector<double>& d, double reach, double& t_lo, double& t_hi) {
+      t_lo = -reach;
+      t_hi = reach;
+      for (size_t k=0; k<x.size(); ++k) {
+        if (d[k] > 0.0) {
+          t_lo = std::max(t_lo, (b.lo[k] - x[k]) / d[k]);
+          t_hi = std::min(t_hi, (b.hi[k] - x[k]) / d[k]);
+        } else if (d[k] < 0.0) {
+          t_lo = std::max(t_lo, (b.hi[k] - x[k]) / d[k]);
+          t_hi = std::min(t_hi, (b.lo[k] - x[k]) / d[k]);
+        }
+      }
+    }
+
+    // Powell's method from x, with initial step sizes step[k] along each
+    // axis; x and value are updated in place
+    template <typename F>
+    void powell(F f, const box& b, std::vector<double>& x, double& value,
+      const std::vector<double>& step, const options& opt) {
+      const size_t dim = x.size();
+      std::vector<std::vector<double>> dirs(dim, std::vector<double>(dim, 0.0));
+      for (size_t k=0; k<dim; ++k)
+        dirs[k][k] = step[k];
+      std::vector<double> trial(dim);
+
+      // Minimise along d from x, moving x; returns the decrease in f
+      auto line_search = [&](const std::vector<double>& d) {
+        double t_lo, t_hi;
+        line_range(b, x, d, 2.0, t_lo, t_hi);
+        if (!(t_lo < t_hi))
+          return 0.0;
+        double g_min;
+        double t = brent([&](double t) {
+          for (size_t k=0; k<dim; ++k)
+            trial[k] = x[k] + t * d[k];
+          return f(trial.data());
+        }, t_lo, t_hi, opt.tolerance, opt.max_iterations, g_min);
+        if (!(g_min < value))
+          return 0.0;
+        for (size_t k=0; k<dim; ++k)
+          x[k] += t * d[k];
+        double decrease = value - g_min;
+        value = g_min;
+        return decrease;
+      };
+
+      for (size_t pass=0; pass<opt.max_iterations; ++pass) {
+        std::vector<double> start = x;
+        double start_value = value, biggest = 0.0;
+        size_t biggest_dir = 0;
+        for (size_t k=0; k<dim; ++k) {
+          double decrease = line_search(dirs[k]);
+          if (decrease > biggest) {
+            biggest = decrease;
+            biggest_dir = k;
+          }
+        }
+        if (2.0 * (start_value - value) <=
+          opt.tolerance * (std::abs(start_value) + std::abs(value)) + 1e-300)
+          break;
+        // Replace the direction of biggest decrease by the overall move
+        std::vector<double> move(dim);
+        for (size_t k=0; k<dim; ++k)
+          move[k] = x[k] - start[k];
+        dirs[biggest_dir] = dirs.back();
+        dirs.back() = move;
+        line_search(move);
+      }
+    }
+
+  } // namespace detail
+
+
+  inline result minimise(const objective& f, const box& b, const options& opt = options()) {
+    const size_t dim = b.dim();
+    std::atomic<size_t> evaluations{0};
+
+    // Coarse grid, the same number of points along each axis
+    size_t per_axis = std::max<size_t>(2, size_t(std::pow(double(opt.grid_points), 1.0 / dim)));
+    std::vector<size_t> points(dim, per_axis), strides(dim);
+    std::vector<double> spacing(dim);
+    size_t total = 1;
+    for (size_t d=0; d<dim; ++d) {
+      strides[d] = total;
+      total *= points[d];
+      spacing[d] = (b.hi[d] - b.lo[d]) / (points[d] - 1);
+    }
+    auto grid_point = [&](size_t i, double* x) {
+      for (size_t d=0; d<dim; ++d) {
+        x[d] = b.lo[d] + spacing[d] * ((i / strides[d]) % points[d]);
+      }
+    };
+
+    std::vector<double> values(total);
+    tbb::enumerable_thread_specific<std::vector<double>> buffers;
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, total, opt.batch),
+      [&](const tbb::blocked_range<size_t>& r) {
+        std::vector<double>& x = buffers.local();
+        x.resize(r.size() * dim);
+        for (size_t i=r.begin(); i!=r.end(); ++i)
+          grid_point(i, x.data() + (i - r.begin()) * dim);
+        f(x.data(), r.size(), values.data() + r.begin());
+        evaluations += r.size();
+      });
+
+    detail::best_candidates candidates(values, points, strides, opt.candidates);
+    tbb::parallel_reduce(tbb::blocked_range<size_t>(0, total), candidates);
+
+    // Refine every candidate, in parallel
+    std::vector<minimum> refined(candidates.best.size());
+    tbb::parallel_for(size_t(0), refined.size(), [&](size_t c) {
+      size_t local_evaluations = 0;
+      auto eval = [&](const double* x) {
+        double value;
+        f(x, 1, &value);
+        ++local_evaluations;
+        return value;
+      };
+      minimum& m = refined[c];
+      m.x.resize(dim);
+      grid_point(candidates.best[c].second, m.x.data());
+      m.value = candidates.best[c].first;
+      if (dim == 1) {
+        // The minimum is within a grid spacing of the candidate
+        double lo = std::max(b.lo[0], m.x[0] - spacing[0]);
+        double hi = std::min(b.hi[0], m.x[0] + spacing[0]);
+        double value;
+        double x = detail::brent([&](double t) { return eval(&t); },
+          lo, hi, opt.tolerance, opt.max_iterations, value);
+        if (value <= m.value) {
+          m.x[0] = x;
+          m.value = value;
+        }
+      } else {
+        detail::powell(eval, b, m.x, m.value, spacing, opt);
+      }
+      evaluations += local_evaluations;
+    });
+
+    // Sort, and drop starts that ended up at the same minimum
+    std::sort(refined.begin(), refined.end(),
+      [](const minimum& a, const minimum& b) { return a.value < b.value; });
+    result res;
+    for (auto& m: refined) {
+      bool seen = false;
+      for (auto& kept: res.minima) {
+        double dist2 = 0.0;
+        for (size_t d=0; d<dim; ++d) {
+          double scaled = (m.x[d] - kept.x[d]) / spacing[d];
+          dist2 += scaled * scaled;
+        }
+        if (dist2 < 0.25)
+          seen = true;
+      }
+      if (!seen)
+        res.minima.push_back(m);
+    }
+    res.evaluations = evaluations;
+    return res;
+  }
+
+} // namespace minimise
+
+#endif  // MINIMISER_H
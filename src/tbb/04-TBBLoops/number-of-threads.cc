@@ -1,6 +1,13 @@
 /*
 illustration of control of number of threads and object-based TBB tasks (as
 opposed to function-based tasks)
+
+number-of-threads [THREADS] [TASKS]
+
+The old task_scheduler_init is gone from oneTBB: global_control now caps
+the number of threads for the whole program and a task_arena gives the
+work its own number of slots. See scaling-sweep for running over many
+thread counts.
 */
 
 #include <vector>
@@ -28,30 +35,37 @@ struct mytask {
 };
 
 int main(int argn, char* argv[]){
-    int threads = tbb::task_scheduler_init::default_num_threads();
-    if (argn==2) {
+    int threads = tbb::info::default_concurrency();
+    int n_tasks = 1000;
+    if (argn>=2 && std::atoi(argv[1]) > 0) {
         threads = std::atoi(argv[1]);
     }
+    if (argn>=3) {
+        n_tasks = std::atoi(argv[2]);
+    }
 
-    tbb::task_scheduler_init init(threads);
+    tbb::global_control control(tbb::global_control::max_allowed_parallelism, threads);
+    tbb::task_arena arena(threads);
     std::cout << "Initialised TBB with " << threads << " threads" << std::endl;
 
     std::vector<mytask> tasks;
-    for (int i=0; i < 1000;++i){
+    for (int i=0; i < n_tasks;++i){
         tasks.push_back(mytask(i));
     }
 
     tbb::tick_count t0 = tbb::tick_count::now();
 
-    tbb::parallel_for(
-        tbb::blocked_range<size_t>(0, tasks.size()),
-        [&tasks](const tbb::blocked_range<size_t>& r){
-            double total=0.0;
-            for (size_t i = r.begin(); i < r.end(); ++i) {
-                total += tasks[i]();
+    arena.execute([&tasks]{
+        tbb::parallel_for(
+            tbb::blocked_range<size_t>(0, tasks.size()),
+            [&tasks](const tbb::blocked_range<size_t>& r){
+                double total=0.0;
+                for (size_t i = r.begin(); i < r.end(); ++i) {
+                    total += tasks[i]();
+                }
             }
-        }
-    );
+        );
+    });
     tbb::tick_count t1 = tbb::tick_count::now();
     auto tick_interval = t1-t0;
     std::cout << "Execution took "
@@ -0,0 +1,76 @@
+// Mandelbrot set by Mariani-Silver subdivision, see mandelms.hpp,
+// checked against a brute force render of every point
+//
+// parallel-mandel-ms [GRID SIZE] [MAX_ITER] [X Y SIZE] [IMAGE]
+//
+// X Y SIZE give the centre and side of the square of the complex plane to
+// render, by default the whole set (0 0 4); if IMAGE is given the
+// Mariani-Silver map is written to it as a .pgm or .ppm file. Exits with
+// 1 if any point differs from the brute force render, which can happen
+// for filaments thinner than the grid spacing (see mandelms.hpp).
+
+#include <iostream>
+#include <string>
+#include <tbb/tbb.h>
+
+#include "mandel.hpp"
+#include "mandelgrid.hpp"
+#include "mandelms.hpp"
+
+int main(int argc, char* argv[]) {
+  mandel::view v{0.0, 0.0, 4.0, 1000};
+  unsigned int max_iter = 256;
+  if (argc>=2)
+    v.resolution = std::stoul(argv[1]);
+  if (argc>=3)
+    max_iter = std::stoul(argv[2]);
+  if (argc>=6) {
+    v.centre_x = std::stod(argv[3]);
+    v.centre_y = std::stod(argv[4]);
+    v.size = std::stod(argv[5]);
+  }
+  std::cout << "Mandel on a grid of " << v.resolution << " centred at ("
+      << v.centre_x << "," << v.centre_y << ") side " << v.size
+      << ", max_iter " << max_iter << std::endl;
+
+  mandel::count_grid brute(v.resolution, v.resolution), ms(v.resolution, v.resolution);
+
+  tbb::tick_count t0 = tbb::tick_count::now();
+  uint64_t brute_iterations = mandel::brute_force(brute, v, max_iter);
+  tbb::tick_count t1 = tbb::tick_count::now();
+  double brute_time = (t1-t0).seconds();
+  std::cout << "Brute force took " << brute_time << "s, "
+      << brute_iterations << " iterations" << std::endl;
+
+  mandel::mariani_silver renderer(ms, v, max_iter);
+  t0 = tbb::tick_count::now();
+  renderer.render();
+  t1 = tbb::tick_count::now();
+  double ms_time = (t1-t0).seconds();
+  uint64_t ms_iterations = renderer.iterations_run();
+  std::cout << "Mariani-Silver took " << ms_time << "s, "
+      << ms_iterations << " iterations, "
+      << renderer.points_filled() << " points filled" << std::endl;
+  std::cout << "Iteration reduction " << double(brute_iterations)/ms_iterations
+      << ", speed-up " << brute_time/ms_time << std::endl;
+
+  size_t mismatches = 0;
+  for (size_t i=0; i<v.resolution; ++i)
+    for (size_t j=0; j<v.resolution; ++j)
+      if (brute(i, j) != ms(i, j))
+        ++mismatches;
+  std::cout << "Points differing from brute force: " << mismatches << std::endl;
+  if (mismatches)
+    std::cerr << "Mariani-Silver render differs from brute force at " << mismatches
+        << " of " << v.resolution * v.resolution << " points" << std::endl;
+
+  if (argc>=7) {
+    if (!mandel::write_image(ms, max_iter, argv[6])) {
+      std::cerr << "Failed to write image " << argv[6] << std::endl;
+      return 1;
+    }
+    std::cout << "Wrote " << argv[6] << std::endl;
+  }
+
+  return mismatches ? 1 : 0;
+}
@@ -1,76 +1,96 @@
 // Mandelbrot set generator using 2D TBB blocked range
-// Internally use a vector of bools for the result map, which allows
-// for easier setting of a dynamic resolution
+// Internally use a contiguous, cache line aligned grid of iteration
+// counts for the result map, which allows for easier setting of a
+// dynamic resolution
 //
-// parallel_mandel_vector [GRID SIZE] [RUN_SERIAL]
+// parallel_mandel_vector [GRID SIZE] [RUN_SERIAL] [KERNEL] [IMAGE]
+//
+// RUN_SERIAL starting with 'n' skips the serial calculation; KERNEL is
+// one of complex, scalar or simd (default), see mandel.hpp; if IMAGE is
+// given the map is written to it as a .pgm (grey) or .ppm (colour) file
 
 #include <iostream>
 #include <vector>
 #include <complex>
 #include <tbb/tbb.h>
 
+#include "mandel.hpp"
+#include "mandelgrid.hpp"
+
 const unsigned int max_iter=256;
 const size_t default_resolution=150;
 
-// Function that returns true/false if a starting point is considered to be
-// inside the Mandelbrot set (at least still inside after max_iter iterations)
-bool inside_mandel(std::complex<float> c) {
+// Function that returns the number of iterations a starting point stays
+// inside the Mandelbrot set for, max_iter meaning it is considered to be
+// inside the set
+unsigned int mandel_count(std::complex<float> c) {
   unsigned int iter=0;
   std::complex<float> z(0.0, 0.0);
-  while (iter++ < max_iter) {
+  while (iter < max_iter) {
     z = z*z + c;
     if (std::norm(z) > 4.0f)
-      return false;
+      return iter;
+    ++iter;
   }
-  return true;
+  return max_iter;
 }
 
-// Class definition for TBB parallelised Mandelbrot set calculation
+// Calculate the counts of grid row i for columns [j_begin, j_end) with
+// the chosen kernel
+void mandel_row(mandel::kernel kernel, size_t resolution, size_t i,
+  size_t j_begin, size_t j_end, uint32_t* row) {
+  // Points are set up in chunks, so the SIMD kernel gets a batch at once
+  const size_t chunk = 256;
+  float cx[chunk], cy[chunk];
+  for (size_t j0=j_begin; j0<j_end; j0+=chunk) {
+    size_t n = std::min(chunk, j_end - j0);
+    for (size_t j=0; j<n; ++j) {
+      cx[j] = double(i)/resolution * 4.0 - 2.0;
+      cy[j] = double(j0+j)/resolution * 4.0 - 2.0;
+    }
+    if (kernel == mandel::kernel::simd) {
+      mandel::escape_counts(cx, cy, n, max_iter, row + j0);
+      continue;
+    }
+    for (size_t j=0; j<n; ++j) {
+#ifdef DEBUG
+      std::cout << "Trying " << cx[j] << "," << cy[j] << " ";
+#endif
+      if (kernel == mandel::kernel::complex)
+        row[j0+j] = mandel_count(std::complex<float>(cx[j], cy[j]));
+      else
+        row[j0+j] = mandel::escape_count(cx[j], cy[j], max_iter);
+#ifdef DEBUG
+      std::cout << row[j0+j] << std::endl;
+#endif
+    }
+  }
+}
+
+// Class definition for TBB parallelised Mandelbrot set calculation, the
+// tiles are whole cache lines of the grid wide, so they never share one
 class parallel_mandel {
 private:
-  std::vector<std::vector<bool>>* my_set;
-  size_t resolution;
+  mandel::count_grid* my_set;
+  mandel::kernel my_kernel;
 
 public:
   void operator()(tbb::blocked_range2d<size_t>& r) const {
-    std::vector<std::vector<bool>>* set = my_set;
+    mandel::count_grid* set = my_set;
+    size_t j_begin = set->column_begin(r.cols()), j_end = set->column_end(r.cols());
     for (size_t i=r.rows().begin(); i!=r.rows().end(); ++i) {
-      for (size_t j=r.cols().begin(); j!=r.cols().end(); ++j) {
-        std::complex<float> z0(
-            double(i)/resolution * 4.0 - 2.0,
-            double(j)/resolution * 4.0 - 2.0
-        );
-#ifdef DEBUG
-        std::cout
-        << "Trying "
-        << z0.real()
-        << ","
-        << z0.imag()
-        << " ";
-#endif
-        (*set)[i][j] = inside_mandel(z0);
-#ifdef DEBUG
-        std::cout << (*set)[i][j] << std::endl;
-#endif
-      }
+      mandel_row(my_kernel, set->height(), i, j_begin, j_end, set->row(i));
     }
   }
 
-  parallel_mandel(std::vector<std::vector<bool>>* set):
-    my_set{set}, resolution{set->size()} {};
+  parallel_mandel(mandel::count_grid* set, mandel::kernel kernel):
+    my_set{set}, my_kernel{kernel} {};
 };
 
 // Simple serial implementation of Mandelbrot set finder
-void serial_mandel(std::vector<std::vector<bool>>* set) {
-  size_t resolution=set->size();
-  for (size_t i=0; i<set->size(); ++i) {
-    for (size_t j=0; j<(*set)[i].size(); ++j) {
-      std::complex<float> z0(
-          double(i)/resolution * 4.0 - 2.0,
-          double(j)/resolution * 4.0 - 2.0
-      );
-      (*set)[i][j] = inside_mandel(z0);
-    }
+void serial_mandel(mandel::count_grid* set, mandel::kernel kernel) {
+  for (size_t i=0; i<set->height(); ++i) {
+    mandel_row(kernel, set->height(), i, 0, set->width(), set->row(i));
   }
 }
 
@@ -80,23 +100,24 @@ int main(int argc, char* argv[]) {
   if (argc>=2) {
     res = std::stoul(argv[1]);
   }
-  if (argc==3 and argv[2][0] == 'n') {
+  if (argc>=3 and argv[2][0] == 'n') {
     do_serial = false;
   }
-  std::cout << "Starting mandel on a grid of " << res << std::endl;
-
-  std::vector<std::vector<bool>> set;
-  set.reserve(res);
-  for (size_t i=0; i<res; ++i) {
-    std::vector<bool> a(res, false);
-    set.push_back(a);
+  mandel::kernel kernel = mandel::kernel::simd;
+  if (argc>=4 && !mandel::parse_kernel(argv[3], kernel)) {
+    std::cerr << "Unknown kernel " << argv[3] << ", use complex, scalar or simd" << std::endl;
+    return 1;
   }
+  std::cout << "Starting mandel on a grid of " << res << " with the "
+      << mandel::kernel_name(kernel) << " kernel" << std::endl;
+
+  mandel::count_grid set(res, res);
 
   tbb::tick_count t0, t1;
   tbb::tick_count::interval_t serial_tick_interval, parallel_tick_interval;
   if (do_serial) {
     t0 = tbb::tick_count::now();
-    serial_mandel(&set);
+    serial_mandel(&set, kernel);
     t1 = tbb::tick_count::now();
     serial_tick_interval = t1-t0;
     std::cout << "Serial mandel took "
@@ -109,8 +130,8 @@ int main(int argc, char* argv[]) {
 
   t0 = tbb::tick_count::now();
   tbb::parallel_for(
-      tbb::blocked_range2d<size_t>(0, res, 0, res),
-      parallel_mandel(&set)
+      set.tiles(),
+      parallel_mandel(&set, kernel)
   );
   t1 = tbb::tick_count::now();
   parallel_tick_interval = t1-t0;
@@ -124,11 +145,21 @@ int main(int argc, char* argv[]) {
         << "s" << std::endl;
   }
 
+  if (argc>=5) {
+    t0 = tbb::tick_count::now();
+    if (!mandel::write_image(set, max_iter, argv[4])) {
+      std::cerr << "Failed to write image " << argv[4] << std::endl;
+      return 1;
+    }
+    t1 = tbb::tick_count::now();
+    std::cout << "Wrote " << argv[4] << " in " << (t1-t0).seconds() << "s" << std::endl;
+  }
+
   // Now print the map of points (if it's reasonable!)
   if (res <= 150) {
     for (size_t i=0; i<res; ++i) {
       for (size_t j=0; j<res; ++j) {
-        if (set[j][i])
+        if (set(j, i) == max_iter)
           std::cout << " ";
         else
           std::cout << ".";
@@ -1,65 +1,103 @@
 // Mandelbrot set generator using 2D TBB blocked range
+//
+// parallel_mandel [KERNEL] [IMAGE]
+//
+// KERNEL is one of complex, scalar or simd (default), see mandel.hpp; if
+// IMAGE is given the map is written to it as a .pgm (grey) or .ppm
+// (colour) file
 
 #include <iostream>
 #include <vector>
 #include <complex>
 #include <tbb/tbb.h>
 
+#include "mandel.hpp"
+#include "mandelgrid.hpp"
+
 const unsigned int max_iter=256;
 const size_t res=1000;
 const float box=2.0;
 
-bool in_mandel(std::complex<float> c) {
+// Number of iterations c stays inside the set for, max_iter meaning it
+// is taken to be in the set
+unsigned int mandel_count(std::complex<float> c) {
   std::complex<float> z(0.0, 0.0);
-  unsigned int iter=0;
-  bool in_set=true;
-  while (in_set && (++iter < max_iter)) {
+  for (unsigned int iter=0; iter<max_iter; ++iter) {
     z = z*z + c;
     if (std::abs(z) > 2.0)
-      in_set=false;
+      return iter;
   }
-  return in_set;
+  return max_iter;
 }
 
-void serial_mandel(bool (*set)[res]) {
-  for (size_t i=0; i!=res; ++i) {
-    for (size_t j=0; j!=res; ++j) {
+// Calculate the escape counts of grid row i for j in [j_begin, j_end)
+// with the chosen kernel
+void mandel_row(mandel::kernel kernel, size_t i, size_t j_begin, size_t j_end, uint32_t* row) {
+  if (kernel == mandel::kernel::complex) {
+    for (size_t j=j_begin; j!=j_end; ++j) {
       std::complex<float> c(
           double(i)/res * 2 * box - box,
           double(j)/res * 2 * box - box
       );
-      set[i][j] = in_mandel(c);
+      row[j] = mandel_count(c);
     }
+    return;
+  }
+  float cx[res], cy[res];
+  size_t n = j_end - j_begin;
+  for (size_t j=j_begin; j!=j_end; ++j) {
+    cx[j-j_begin] = double(i)/res * 2 * box - box;
+    cy[j-j_begin] = double(j)/res * 2 * box - box;
+  }
+  if (kernel == mandel::kernel::simd) {
+    mandel::escape_counts(cx, cy, n, max_iter, row + j_begin);
+  } else {
+    for (size_t j=0; j<n; ++j)
+      row[j_begin+j] = mandel::escape_count(cx[j], cy[j], max_iter);
+  }
+}
+
+void serial_mandel(mandel::count_grid& set, mandel::kernel kernel) {
+  for (size_t i=0; i!=res; ++i) {
+    mandel_row(kernel, i, 0, res, set.row(i));
   }
 }
 
+// The grid's tiles are whole cache lines wide, so no two tiles
+// ever write to the same cache line
 class parallel_mandel {
 private:
-  bool (*my_set)[res];
+  mandel::count_grid& my_set;
+  mandel::kernel my_kernel;
 
 public:
   void operator()(tbb::blocked_range2d<size_t>& r) const {
-    bool (*set)[res] = my_set;
+    size_t j_begin = my_set.column_begin(r.cols()), j_end = my_set.column_end(r.cols());
     for (size_t i=r.rows().begin(); i!=r.rows().end(); ++i) {
-      for (size_t j=r.cols().begin(); j!=r.cols().end(); ++j) {
-        std::complex<float> c(
-            double(i)/res * 2 * box - box,
-            double(j)/res * 2 * box - box
-        );
-        set[i][j] = in_mandel(c);
-      }
+      mandel_row(my_kernel, i, j_begin, j_end, my_set.row(i));
     }
   }
 
-  parallel_mandel(bool set[res][res]):
-    my_set{set} {};
+  parallel_mandel(mandel::count_grid& set, mandel::kernel kernel):
+    my_set{set}, my_kernel{kernel} {};
 };
 
-int main() {
-  bool set[res][res];
+int main(int argc, char* argv[]) {
+  mandel::kernel kernel = mandel::kernel::simd;
+  if (argc >= 2 && !mandel::parse_kernel(argv[1], kernel)) {
+    std::cerr << "Unknown kernel " << argv[1] << ", use complex, scalar or simd" << std::endl;
+    return 1;
+  }
+  std::cout << "Using the " << mandel::kernel_name(kernel) << " kernel";
+  if (kernel == mandel::kernel::simd)
+    std::cout << " (" << simdmath::isa_name(simdmath::active_isa()) << ", "
+        << simdmath::lanes<float>() << " lanes)";
+  std::cout << std::endl;
+
+  mandel::count_grid set(res, res);
 
   tbb::tick_count t0 = tbb::tick_count::now();
-  serial_mandel(set);
+  serial_mandel(set, kernel);
   tbb::tick_count t1 = tbb::tick_count::now();
   auto serial_tick_interval = t1-t0;
   std::cout << "Serial mandel took "
@@ -69,8 +107,8 @@ int main() {
 
   t0 = tbb::tick_count::now();
   tbb::parallel_for(
-      tbb::blocked_range2d<size_t>(0, res, 0, res),
-      parallel_mandel(set)
+      set.tiles(),
+      parallel_mandel(set, kernel)
   );
   t1 = tbb::tick_count::now();
   auto parallel_tick_interval = t1-t0;
@@ -83,11 +121,19 @@ int main() {
       << serial_tick_interval.seconds()/parallel_tick_interval.seconds()
       << "x" << std::endl;
 
+  if (argc >= 3) {
+    if (!mandel::write_image(set, max_iter, argv[2])) {
+      std::cerr << "Failed to write image " << argv[2] << std::endl;
+      return 1;
+    }
+    std::cout << "Wrote " << argv[2] << std::endl;
+  }
+
   // Now print the map of points (if it's a reasonable size)
   if (res <= 150) {
     for (size_t i=0; i<res; ++i) {
       for (size_t j=0; j<res; ++j) {
-        if (set[j][i])
+        if (set(j, i) == max_iter)
           std::cout << " ";
         else
           std::cout << ".";
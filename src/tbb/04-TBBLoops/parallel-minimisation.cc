@@ -1,12 +1,26 @@
 // TBB Parallel Minimisation, using parallel reduce
+//
+// parallel-minimisation [GRID_POINTS] [CANDIDATES]
+//
+// The brute force MinIndexF search over a fine grid is compared with the
+// minimise() engine of minimiser.hpp, which refines the best CANDIDATES
+// (default 8) local minima of a coarse grid of GRID_POINTS (default 10000)
+// points. The engine is also run on two N-D functions with known minima,
+// and the program fails if it misses any of them.
 
 #include <iostream>
+#include <iomanip>
 #include <limits>
 #include <cmath>
 #include <chrono>
+#include <string>
+#include <vector>
 
 #include "tbb/tbb.h"
 
+#include "minimiser.hpp"
+#include "simdmath.hpp"
+
 // The function to minimise
 double f(double x) {
     return std::exp(x) - std::pow(x, 3);
@@ -48,22 +62,110 @@ public:
     {}
 };
 
+// The same function on a batch of points, with the exponentials done in
+// SIMD lanes
+void f_batch(const double* x, size_t n, double* values) {
+    simdmath::exp(x, values, n);
+    for (size_t i = 0; i < n; ++i)
+        values[i] -= x[i] * x[i] * x[i];
+}
+
+// Himmelblau's function, with four minima of 0
+double himmelblau(const double* x) {
+    double a = x[0] * x[0] + x[1] - 11.0;
+    double b = x[0] + x[1] * x[1] - 7.0;
+    return a * a + b * b;
+}
+
+// Rosenbrock's function in 4D, a curved valley with its minimum of 0 at
+// (1, 1, 1, 1)
+double rosenbrock(const double* x) {
+    double sum = 0.0;
+    for (size_t i = 0; i < 3; ++i) {
+        double a = x[i+1] - x[i] * x[i];
+        double b = 1.0 - x[i];
+        sum += 100.0 * a * a + b * b;
+    }
+    return sum;
+}
+
+void print_minima(const std::string& name, const minimise::result& res, double seconds) {
+    std::cout << name << ": " << res.minima.size() << " minima, "
+        << res.evaluations << " evaluations, " << seconds * 1000.0 << "ms" << std::endl;
+    for (auto& m: res.minima) {
+        std::cout << "  x=(";
+        for (size_t d = 0; d < m.x.size(); ++d)
+            std::cout << (d ? ", " : "") << m.x[d];
+        std::cout << "); f=" << m.value << std::endl;
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    minimise::options opt;
+    if (argc >= 2)
+        opt.grid_points = std::stoul(argv[1]);
+    if (argc >= 3)
+        opt.candidates = std::stoul(argv[2]);
+    if (opt.grid_points < 2 || opt.candidates == 0) {
+        std::cerr << "Need at least 2 grid points and 1 candidate" << std::endl;
+        return 1;
+    }
 
-int main() {
     const double x_min = -10.0;
     const double x_max =  10.0;
     const size_t n = 100000;
 
+    tbb::tick_count t0 = tbb::tick_count::now();
     double *x = new double[n];
     for (size_t i = 0; i < n; ++i) x[i] = x_min + (x_max - x_min) / n * i;
 
     auto min_finder = MinIndexF(x);
     tbb::parallel_reduce(tbb::blocked_range<size_t>(0,n), min_finder);
+    tbb::tick_count t1 = tbb::tick_count::now();
 
+    std::cout << std::setprecision(16);
     std::cout << "Function f minimised at x=" << x[min_finder.index_of_min] 
-    << "; f(x_min)=" << min_finder.value_of_min << std::endl;
+    << "; f(x_min)=" << min_finder.value_of_min << " (grid of " << n << ", "
+    << (t1-t0).seconds() * 1000.0 << "ms)" << std::endl;
 
+    // The minimum is where f'(x) = exp(x) - 3x^2 = 0, found by Newton's
+    // method from the grid answer for reference
+    double x_true = x[min_finder.index_of_min];
+    for (int i = 0; i < 50; ++i)
+        x_true -= (std::exp(x_true) - 3.0 * x_true * x_true) / (std::exp(x_true) - 6.0 * x_true);
     delete[] x;
 
+    t0 = tbb::tick_count::now();
+    minimise::result res = minimise::minimise(f_batch, {{x_min}, {x_max}}, opt);
+    t1 = tbb::tick_count::now();
+    print_minima("f", res, (t1-t0).seconds());
+    double x_error = std::abs(res.minima[0].x[0] - x_true);
+    double f_error = std::abs(res.minima[0].value - f(x_true));
+    std::cout << "  |x - x_true|=" << x_error << "; |f - f(x_true)|=" << f_error << std::endl;
+
+    t0 = tbb::tick_count::now();
+    minimise::result himmelblau_res = minimise::minimise(
+        minimise::pointwise(2, himmelblau), {{-5.0, -5.0}, {5.0, 5.0}}, opt);
+    t1 = tbb::tick_count::now();
+    print_minima("Himmelblau", himmelblau_res, (t1-t0).seconds());
+
+    t0 = tbb::tick_count::now();
+    minimise::result rosenbrock_res = minimise::minimise(
+        minimise::pointwise(4, rosenbrock), {std::vector<double>(4, -2.0), std::vector<double>(4, 2.0)}, opt);
+    t1 = tbb::tick_count::now();
+    print_minima("Rosenbrock", rosenbrock_res, (t1-t0).seconds());
+
+    // Check against the known answers
+    bool ok = x_error < 1e-7 && f_error < 1e-12;
+    size_t zeros = 0;
+    for (auto& m: himmelblau_res.minima)
+        if (m.value < 1e-12) ++zeros;
+    ok = ok && zeros == 4 && rosenbrock_res.minima[0].value < 1e-12;
+    if (!ok) {
+        std::cerr << "Minimisation did not reach the known minima" << std::endl;
+        return 1;
+    }
+
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,344 @@
+// Partitioner and grain size sweep over the loop bodies of the TBB loop
+// examples
+//
+// partitioner-sweep [CSV FILE] [PASSES] [SCALE]
+//
+// Each workload is run with simple_partitioner for a range of grain sizes
+// (powers of 4), then with auto_partitioner, static_partitioner and
+// affinity_partitioner. The same affinity_partitioner is reused for all
+// of a workload's passes, so later passes can benefit from the cache
+// affinity it recorded. Every pass gives one CSV line (to CSV FILE, or
+// stdout if it's "-" or not given) with:
+//
+//   workload  - burn (parallel-for-basic and -lambda), reduce
+//               (parallel-reduce), mandel (parallel-mandel, 2D tiles with
+//               the grain in rows), filter (generate-and-filter), then
+//               calibrated synthetic items with uniform, bimodal, pareto
+//               and skew costs, and pareto-chase, pareto costs spent
+//               chasing pointers through a 64MB buffer
+//   partitioner, grain, threads, pass
+//   seconds   - wall time of the loop
+//   tasks     - number of times the body was run, i.e., chunks of range
+//   imbalance - busiest thread's time in the body over the mean time of
+//               all threads, 1 is perfect balance
+//
+// SCALE multiplies the size of every workload (default 1).
+//
+// N.B. timing each body invocation costs a few tens of nanoseconds, which
+// shows at very small grain sizes.
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tbb/tbb.h"
+
+#include "mandel.hpp"
+#include "mandelgrid.hpp"
+#include "tutorialutils.h"
+
+// Counts tasks and busy time per thread for the body it wraps
+class instrument {
+private:
+  tbb::enumerable_thread_specific<double> m_busy;
+  tbb::enumerable_thread_specific<size_t> m_tasks;
+
+public:
+  instrument():
+    m_busy{0.0}, m_tasks{0} {};
+
+  // Adds the lifetime of the timer to its thread's busy time
+  struct timer {
+    instrument& ins;
+    tbb::tick_count start;
+
+    ~timer() {
+      ins.m_busy.local() += (tbb::tick_count::now() - start).seconds();
+      ++ins.m_tasks.local();
+    }
+  };
+
+  // A body that forwards to body, timing each call
+  template <typename Body>
+  auto wrap(Body body) {
+    return [this, body](auto&&... args) -> decltype(auto) {
+      timer t{*this, tbb::tick_count::now()};
+      return body(std::forward<decltype(args)>(args)...);
+    };
+  }
+
+  size_t tasks() {
+    return m_tasks.combine(std::plus<size_t>());
+  }
+
+  double imbalance() {
+    double total = 0.0, busiest = 0.0;
+    for (auto t: m_busy) {
+      total += t;
+      busiest = std::max(busiest, t);
+    }
+    int threads = tbb::this_task_arena::max_concurrency();
+    return total > 0.0 ? busiest / (total / threads) : 1.0;
+  }
+};
+
+
+// The workloads, run(partitioner, grain, instrument) does one pass
+
+// parallel-for-basic and parallel-for-lambda
+class burn_work {
+private:
+  std::vector<double> m_x;
+
+public:
+  static const char* name() { return "burn"; }
+
+  burn_work(double scale):
+    m_x(size_t(20000 * scale)) {};
+
+  size_t size() const { return m_x.size(); }
+
+  template <typename Partitioner>
+  void run(Partitioner& partitioner, size_t grain, instrument& ins) {
+    double* x = m_x.data();
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, m_x.size(), grain),
+      ins.wrap([=](const tbb::blocked_range<size_t>& r) {
+        for (size_t i=r.begin(); i!=r.end(); ++i)
+          x[i] = burn(100);
+      }), partitioner);
+  }
+};
+
+// parallel-reduce
+class reduce_work {
+private:
+  std::vector<double> m_x;
+
+public:
+  double answer;
+
+  static const char* name() { return "reduce"; }
+
+  reduce_work(double scale):
+    m_x(size_t(20000 * scale)), answer{0.0} {};
+
+  size_t size() const { return m_x.size(); }
+
+  template <typename Partitioner>
+  void run(Partitioner& partitioner, size_t grain, instrument& ins) {
+    double* x = m_x.data();
+    answer = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, m_x.size(), grain), 0.0,
+      ins.wrap([=](const tbb::blocked_range<size_t>& r, double running) {
+        for (size_t i=r.begin(); i!=r.end(); ++i) {
+          x[i] = burn(100);
+          running += x[i];
+        }
+        return running;
+      }), std::plus<double>(), partitioner);
+  }
+};
+
+// parallel-mandel, the most unbalanced of the workloads
+class mandel_work {
+private:
+  mandel::count_grid m_grid;
+  static const unsigned max_iter = 256;
+
+public:
+  static const char* name() { return "mandel"; }
+
+  mandel_work(double scale):
+    m_grid(size_t(400 * std::sqrt(scale)), size_t(400 * std::sqrt(scale))) {};
+
+  size_t size() const { return m_grid.height(); }
+
+  template <typename Partitioner>
+  void run(Partitioner& partitioner, size_t grain, instrument& ins) {
+    mandel::count_grid& grid = m_grid;
+    tbb::parallel_for(grid.tiles(grain),
+      ins.wrap([&grid](const tbb::blocked_range2d<size_t>& r) {
+        const size_t res = grid.height(), chunk = mandel::count_grid::line_counts;
+        float cx[chunk], cy[chunk];
+        size_t j_begin = grid.column_begin(r.cols()), j_end = grid.column_end(r.cols());
+        for (size_t i=r.rows().begin(); i!=r.rows().end(); ++i) {
+          for (size_t jc=j_begin; jc<j_end; jc+=chunk) {
+            size_t n = std::min(chunk, j_end - jc);
+            for (size_t j=0; j<n; ++j) {
+              cx[j] = double(i)/res * 4.0 - 2.0;
+              cy[j] = double(jc+j)/res * 4.0 - 2.0;
+            }
+            mandel::escape_counts(cx, cy, n, max_iter, grid.row(i) + jc);
+          }
+        }
+      }), partitioner);
+  }
+};
+
+// generate-and-filter's filter step, very little work per element
+class filter_work {
+private:
+  std::vector<float> m_input;
+  tbb::concurrent_vector<float> m_filtered;
+
+public:
+  static const char* name() { return "filter"; }
+
+  filter_work(double scale):
+    m_input(size_t(2000000 * scale)) {
+    std::default_random_engine generator(42);
+    std::uniform_real_distribution<float> distribution(-100.0, 1.0);
+    for (auto& v: m_input)
+      v = distribution(generator);
+  };
+
+  size_t size() const { return m_input.size(); }
+
+  template <typename Partitioner>
+  void run(Partitioner& partitioner, size_t grain, instrument& ins) {
+    m_filtered.clear();
+    const float* input = m_input.data();
+    tbb::concurrent_vector<float>& filtered = m_filtered;
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, m_input.size(), grain),
+      ins.wrap([input, &filtered](const tbb::blocked_range<size_t>& r) {
+        for (size_t i=r.begin(); i!=r.end(); ++i)
+          if (input[i] > 0.0)
+            filtered.push_back(input[i]);
+      }), partitioner);
+  }
+};
+
+
+// Items of known cost from the workload library, spinning or, given a
+// memory_work, chasing pointers through memory
+class irregular_work {
+private:
+  std::vector<double> m_cost;
+  std::string m_name;
+  const workload::memory_work* m_memory;
+  size_t m_pass;
+
+public:
+  const char* name() const { return m_name.c_str(); }
+
+  irregular_work(workload::distribution d, double scale,
+    const workload::memory_work* memory = nullptr):
+    m_cost{workload::costs(d, size_t(2000 * scale), 2000.0)},
+    m_name{workload::distribution_name(d)}, m_memory{memory}, m_pass{0} {
+    if (memory)
+      m_name += "-chase";
+  };
+
+  size_t size() const { return m_cost.size(); }
+
+  template <typename Partitioner>
+  void run(Partitioner& partitioner, size_t grain, instrument& ins) {
+    const double* cost = m_cost.data();
+    const workload::memory_work* memory = m_memory;
+    // Start each pass's chases somewhere new, so they miss the cache
+    const size_t offset = ++m_pass * m_cost.size();
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, m_cost.size(), grain),
+      ins.wrap([=](const tbb::blocked_range<size_t>& r) {
+        for (size_t i=r.begin(); i!=r.end(); ++i) {
+          if (memory)
+            memory->chase_ns(cost[i], (offset + i) * 7919);
+          else
+            workload::spin_ns(cost[i]);
+        }
+      }), partitioner);
+  }
+};
+
+
+class csv_writer {
+private:
+  std::ostream& m_out;
+  int m_threads;
+
+public:
+  csv_writer(std::ostream& out):
+    m_out(out), m_threads{tbb::this_task_arena::max_concurrency()} {
+    m_out << "workload,partitioner,grain,threads,pass,seconds,tasks,imbalance" << std::endl;
+  };
+
+  // Run passes of one configuration, one line per pass
+  template <typename Work, typename Partitioner>
+  void run(Work& work, const char* partitioner_name, Partitioner& partitioner,
+    size_t grain, size_t passes) {
+    for (size_t pass=0; pass<passes; ++pass) {
+      instrument ins;
+      tbb::tick_count t0 = tbb::tick_count::now();
+      work.run(partitioner, grain, ins);
+      tbb::tick_count t1 = tbb::tick_count::now();
+      m_out << work.name() << "," << partitioner_name << "," << grain << ","
+          << m_threads << "," << pass << "," << (t1-t0).seconds() << ","
+          << ins.tasks() << "," << ins.imbalance() << std::endl;
+    }
+  }
+};
+
+template <typename Work>
+void sweep(Work& work, csv_writer& csv, size_t passes) {
+  for (size_t grain=1; grain<work.size(); grain*=4) {
+    tbb::simple_partitioner simple;
+    csv.run(work, "simple", simple, grain, passes);
+  }
+  tbb::auto_partitioner automatic;
+  csv.run(work, "auto", automatic, 1, passes);
+  tbb::static_partitioner fixed;
+  csv.run(work, "static", fixed, 1, passes);
+  tbb::affinity_partitioner affinity;
+  csv.run(work, "affinity", affinity, 1, passes);
+}
+
+int main(int argc, char *argv[]) {
+  std::string csv_name = "-";
+  size_t passes = 3;
+  double scale = 1.0;
+  if (argc >= 2)
+    csv_name = argv[1];
+  if (argc >= 3)
+    passes = std::stoul(argv[2]);
+  if (argc >= 4)
+    scale = std::stod(argv[3]);
+  if (passes == 0 || !(scale > 0.0)) {
+    std::cerr << "Need at least one pass and a positive scale" << std::endl;
+    return 1;
+  }
+
+  std::ofstream csv_file;
+  if (csv_name != "-") {
+    csv_file.open(csv_name);
+    if (!csv_file) {
+      std::cerr << "Failed to open " << csv_name << std::endl;
+      return 1;
+    }
+  }
+  csv_writer csv(csv_name == "-" ? std::cout : csv_file);
+
+  // Time the work unit now, not in the first timed pass of a spin loop
+  workload::calibrate();
+
+  burn_work burner(scale);
+  sweep(burner, csv, passes);
+  reduce_work reducer(scale);
+  sweep(reducer, csv, passes);
+  mandel_work mandel(scale);
+  sweep(mandel, csv, passes);
+  filter_work filter(scale);
+  sweep(filter, csv, passes);
+  for (auto d: workload::all_distributions) {
+    irregular_work irregular(d, scale);
+    sweep(irregular, csv, passes);
+  }
+  workload::memory_work memory(64 << 20);
+  irregular_work chaser(workload::distribution::pareto, scale, &memory);
+  sweep(chaser, csv, passes);
+
+  return 0;
+}
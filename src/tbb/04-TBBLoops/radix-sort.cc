@@ -0,0 +1,168 @@
+// Parallel radix sort against comparison sorts
+//
+// radix-sort [SIZE] [REPEATS]
+//
+// Sorts arrays of 1e4, 1e6 and SIZE (default 1e7) keys of several types
+// and distributions with
+//
+//   radix      - radix::sort from radixsort.hpp
+//   tbb        - tbb::parallel_sort
+//   std::par   - std::sort(std::execution::par, ...), when the standard
+//                library has the parallel algorithms
+//   std        - plain std::sort, for reference
+//
+// and prints the best of REPEATS (default 3) times for each, in ms, and
+// the radix sort's speedup over the fastest comparison sort. The types and
+// distributions are:
+//
+//   float  filter  - uniform in [0, 1), as the output of generate-and-filter
+//   float  normal  - normal around 0, so both signs
+//   double normal  - as above
+//   int32  uniform - all 32 bits random
+//   uint32 small   - uniform in [0, 1000), only the first pass sorts
+//   uint64 index   - shuffled indices, as detector cell numbers
+//   uint64 sorted  - already in order
+//
+// The radix sort does the same work whatever the order of the input, so
+// the comparison sorts win easily on sorted keys. The program fails if a
+// radix sort ever differs from std::sort.
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#if __has_include(<execution>)
+#include <execution>
+#endif
+
+#include "tbb/tbb.h"
+
+#include "radixsort.hpp"
+
+// Best time of repeats runs of sorter on fresh copies of keys, in ms; the
+// last sorted copy is left in sorted
+template <typename T, typename Sorter>
+double time_sort(const std::vector<T>& keys, size_t repeats, Sorter sorter, std::vector<T>& sorted) {
+  double best = 0.0;
+  for (size_t r=0; r<repeats; ++r) {
+    sorted = keys;
+    tbb::tick_count t0 = tbb::tick_count::now();
+    sorter(sorted);
+    double ms = (tbb::tick_count::now() - t0).seconds() * 1000.0;
+    if (r == 0 || ms < best)
+      best = ms;
+  }
+  return best;
+}
+
+template <typename T>
+bool compare_sorts(const std::string& name, const std::vector<T>& keys, size_t repeats) {
+  std::vector<T> radix_sorted, reference;
+  double radix_ms = time_sort(keys, repeats, [](std::vector<T>& v) { radix::sort(v); }, radix_sorted);
+  double tbb_ms = time_sort(keys, repeats,
+    [](std::vector<T>& v) { tbb::parallel_sort(v.begin(), v.end()); }, reference);
+  double best_comparison = tbb_ms;
+#ifdef __cpp_lib_parallel_algorithm
+  double par_ms = time_sort(keys, repeats,
+    [](std::vector<T>& v) { std::sort(std::execution::par, v.begin(), v.end()); }, reference);
+  best_comparison = std::min(best_comparison, par_ms);
+#endif
+  double std_ms = time_sort(keys, repeats,
+    [](std::vector<T>& v) { std::sort(v.begin(), v.end()); }, reference);
+  best_comparison = std::min(best_comparison, std_ms);
+
+  std::cout << std::setw(16) << name << std::setw(10) << keys.size()
+      << std::fixed << std::setprecision(2)
+      << std::setw(10) << radix_ms << std::setw(10) << tbb_ms
+#ifdef __cpp_lib_parallel_algorithm
+      << std::setw(10) << par_ms
+#else
+      << std::setw(10) << "-"
+#endif
+      << std::setw(10) << std_ms
+      << std::setw(9) << best_comparison / radix_ms << "x" << std::endl;
+  std::cout.unsetf(std::ios::fixed);
+
+  if (radix_sorted != reference) {
+    std::cerr << "Radix sort of " << name << " differs from std::sort" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool run_size(size_t n, size_t repeats) {
+  std::mt19937_64 generator(42);
+  bool ok = true;
+
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::vector<float> filtered(n);
+  for (auto& x: filtered)
+    x = unit(generator);
+  ok &= compare_sorts("float filter", filtered, repeats);
+
+  std::normal_distribution<double> normal(0.0, 1.0);
+  std::vector<float> normal_float(n);
+  std::vector<double> normal_double(n);
+  for (size_t i=0; i<n; ++i) {
+    normal_double[i] = normal(generator);
+    normal_float[i] = float(normal_double[i]);
+  }
+  ok &= compare_sorts("float normal", normal_float, repeats);
+  ok &= compare_sorts("double normal", normal_double, repeats);
+
+  std::vector<int32_t> int_keys(n);
+  for (auto& x: int_keys)
+    x = int32_t(generator());
+  ok &= compare_sorts("int32 uniform", int_keys, repeats);
+
+  std::uniform_int_distribution<uint32_t> small(0, 999);
+  std::vector<uint32_t> small_keys(n);
+  for (auto& x: small_keys)
+    x = small(generator);
+  ok &= compare_sorts("uint32 small", small_keys, repeats);
+
+  std::vector<uint64_t> index(n);
+  std::iota(index.begin(), index.end(), 0);
+  ok &= compare_sorts("uint64 sorted", index, repeats);
+  std::shuffle(index.begin(), index.end(), generator);
+  ok &= compare_sorts("uint64 index", index, repeats);
+
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  size_t size = 10000000, repeats = 3;
+  if (argc >= 2)
+    size = std::stoul(argv[1]);
+  if (argc >= 3)
+    repeats = std::stoul(argv[2]);
+  if (repeats == 0) {
+    std::cerr << "Need at least one repeat" << std::endl;
+    return 1;
+  }
+
+  std::cout << "Best of " << repeats << " sorts, ms, with "
+      << tbb::this_task_arena::max_concurrency() << " threads" << std::endl
+      << std::setw(16) << "keys" << std::setw(10) << "n" << std::setw(10) << "radix"
+      << std::setw(10) << "tbb" << std::setw(10) << "std::par" << std::setw(10) << "std"
+      << std::setw(10) << "speedup" << std::endl;
+
+  bool ok = true;
+  std::vector<size_t> sizes;
+  for (size_t n: {size_t(10000), size_t(1000000)})
+    if (n < size)
+      sizes.push_back(n);
+  sizes.push_back(size);
+  for (size_t n: sizes)
+    ok &= run_size(n, repeats);
+
+  if (!ok)
+    return 1;
+  return 0;
+}
@@ -0,0 +1,366 @@
+// Strong and weak scaling sweep over thread counts, with Amdahl and
+// Universal Scalability Law fits
+//
+// scaling-sweep [KERNELS] [MAX_THREADS] [PIN] [CSV FILE]
+//
+// Each kernel is run with 1, 2, ... MAX_THREADS threads (default, the
+// number of cores), capped by a global_control and run in a task_arena of
+// that size. In strong scaling mode the problem size is fixed; in weak
+// scaling mode it grows with the number of threads. KERNELS is a comma
+// separated list of the registered kernels below, or "all" (the default):
+//
+//   spin    - calibrated compute bound items (workload::spin_ns)
+//   stream  - streaming reads through a 64MB buffer, bandwidth bound
+//   mandel  - Mandelbrot rows, unbalanced
+//   atomic  - items that all increment one atomic counter, so the threads
+//             contend for its cache line
+//   serial  - spin items with a serial tenth of the work before them, the
+//             textbook Amdahl case
+//
+// If PIN is "pin" then a task_scheduler_observer pins each thread that
+// joins the arena to a core (given by its arena slot) and unpins it as it
+// leaves. This needs Linux's pthread_setaffinity_np; elsewhere it does
+// nothing.
+//
+// For each kernel and mode the speedup C(p) = p T(1) / (T(p) size ratio),
+// i.e., the throughput relative to one thread, is fitted with
+//
+//   Amdahl:  C(p) = p / (1 + sigma (p - 1))
+//   USL:     C(p) = p / (1 + sigma (p - 1) + kappa p (p - 1))
+//
+// sigma is the serial (contention) fraction and kappa the coherency cost,
+// the pairwise penalty that eventually makes adding threads slow things
+// down. Both fits are linear least squares in p / C(p) - 1. The USL fit
+// predicts the thread count of peak throughput, sqrt((1 - sigma) / kappa),
+// and its throughput at twice and four times MAX_THREADS. A fit needs at
+// least two thread counts, so on one core run with MAX_THREADS > 1 (i.e.,
+// oversubscribed) just to exercise it.
+//
+// One line per measurement goes to CSV FILE, if given, with
+// kernel,mode,threads,size,seconds,speedup,efficiency.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "tbb/tbb.h"
+
+#include "mandel.hpp"
+#include "mandelgrid.hpp"
+#include "tutorialutils.h"
+
+// A kernel does work proportional to size, base_size is the size for
+// strong scaling and one thread's share for weak scaling
+struct kernel {
+  size_t base_size;
+  std::function<void(size_t size)> run;
+};
+
+std::map<std::string, kernel>& registry() {
+  static std::map<std::string, kernel> kernels;
+  return kernels;
+}
+
+void register_kernel(const std::string& name, size_t base_size,
+  std::function<void(size_t)> run) {
+  registry()[name] = kernel{base_size, run};
+}
+
+void register_kernels() {
+  register_kernel("spin", 10000, [](size_t size) {
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, size),
+      [](const tbb::blocked_range<size_t>& r) {
+        for (size_t i=r.begin(); i!=r.end(); ++i)
+          workload::spin_ns(1000.0);
+      });
+  });
+
+  // The buffer is made on first use, as it's timed as it's made
+  register_kernel("stream", 4 << 20, [](size_t size) {
+    static const workload::memory_work memory(64 << 20);
+    volatile double sink = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, size), 0.0,
+      [](const tbb::blocked_range<size_t>& r, double sum) {
+        return sum + memory.stream(r.size(), r.begin());
+      }, std::plus<double>());
+    (void)sink;
+  });
+
+  register_kernel("mandel", 128, [](size_t size) {
+    const size_t width = 256, max_iter = 256;
+    mandel::count_grid grid(width, size);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, size),
+      [&grid, size](const tbb::blocked_range<size_t>& r) {
+        float cx[width], cy[width];
+        for (size_t i=r.begin(); i!=r.end(); ++i) {
+          for (size_t j=0; j<width; ++j) {
+            cx[j] = double(i % 128)/128 * 4.0 - 2.0;
+            cy[j] = double(j)/width * 4.0 - 2.0;
+          }
+          mandel::escape_counts(cx, cy, width, max_iter, grid.row(i));
+        }
+      });
+  });
+
+  register_kernel("atomic", 20000, [](size_t size) {
+    std::atomic<size_t> counter{0};
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, size),
+      [&counter](const tbb::blocked_range<size_t>& r) {
+        for (size_t i=r.begin(); i!=r.end(); ++i) {
+          workload::spin_ns(200.0);
+          counter.fetch_add(1);
+        }
+      });
+  });
+
+  register_kernel("serial", 10000, [](size_t size) {
+    for (size_t i=0; i<size/10; ++i)
+      workload::spin_ns(1000.0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, size - size/10),
+      [](const tbb::blocked_range<size_t>& r) {
+        for (size_t i=r.begin(); i!=r.end(); ++i)
+          workload::spin_ns(1000.0);
+      });
+  });
+}
+
+
+// Pins the threads of an arena to cores as they join it
+class pinning_observer: public tbb::task_scheduler_observer {
+private:
+#ifdef __linux__
+  cpu_set_t m_process_mask;
+  std::vector<int> m_cpus;
+#endif
+
+public:
+  pinning_observer(tbb::task_arena& arena):
+    tbb::task_scheduler_observer(arena) {
+#ifdef __linux__
+    CPU_ZERO(&m_process_mask);
+    sched_getaffinity(0, sizeof(m_process_mask), &m_process_mask);
+    for (int cpu=0; cpu<CPU_SETSIZE; ++cpu)
+      if (CPU_ISSET(cpu, &m_process_mask))
+        m_cpus.push_back(cpu);
+#endif
+    observe(true);
+  }
+
+  ~pinning_observer() {
+    observe(false);
+  }
+
+  static bool available() {
+#ifdef __linux__
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void on_scheduler_entry(bool) override {
+#ifdef __linux__
+    int slot = tbb::this_task_arena::current_thread_index();
+    if (slot < 0 || m_cpus.empty())
+      return;
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(m_cpus[slot % m_cpus.size()], &mask);
+    pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+#endif
+  }
+
+  void on_scheduler_exit(bool) override {
+#ifdef __linux__
+    pthread_setaffinity_np(pthread_self(), sizeof(m_process_mask), &m_process_mask);
+#endif
+  }
+};
+
+
+struct fit {
+  double sigma;
+  double kappa;
+  double rms;  // of the relative error in C(p)
+};
+
+// Least squares fit of p / C(p) - 1 = sigma (p - 1) + kappa p (p - 1), with
+// kappa fixed at 0 for Amdahl; parameters that come out negative are fixed
+// at 0 and the other refitted
+fit fit_scaling(const std::vector<int>& threads, const std::vector<double>& speedup, bool usl) {
+  double saa = 0.0, sab = 0.0, sbb = 0.0, say = 0.0, sby = 0.0;
+  for (size_t i=0; i<threads.size(); ++i) {
+    double p = threads[i], a = p - 1.0, b = p * (p - 1.0), y = p / speedup[i] - 1.0;
+    saa += a * a; sab += a * b; sbb += b * b;
+    say += a * y; sby += b * y;
+  }
+  fit f{0.0, 0.0, 0.0};
+  double det = saa * sbb - sab * sab;
+  if (usl && det > 0.0) {
+    f.sigma = (say * sbb - sby * sab) / det;
+    f.kappa = (saa * sby - sab * say) / det;
+  } else if (saa > 0.0) {
+    f.sigma = say / saa;
+  }
+  if (usl && f.sigma < 0.0 && sbb > 0.0) {
+    f.sigma = 0.0;
+    f.kappa = sby / sbb;
+  } else if (usl && f.kappa < 0.0 && saa > 0.0) {
+    f.sigma = say / saa;
+    f.kappa = 0.0;
+  }
+  f.sigma = std::max(0.0, f.sigma);
+  f.kappa = std::max(0.0, f.kappa);
+  for (size_t i=0; i<threads.size(); ++i) {
+    double p = threads[i];
+    double model = p / (1.0 + f.sigma * (p - 1.0) + f.kappa * p * (p - 1.0));
+    double err = (model - speedup[i]) / speedup[i];
+    f.rms += err * err;
+  }
+  f.rms = std::sqrt(f.rms / threads.size());
+  return f;
+}
+
+double usl_speedup(const fit& f, double p) {
+  return p / (1.0 + f.sigma * (p - 1.0) + f.kappa * p * (p - 1.0));
+}
+
+// Best of a few runs, in seconds
+double time_kernel(const kernel& k, size_t size, int threads, bool pin) {
+  tbb::global_control control(tbb::global_control::max_allowed_parallelism, threads);
+  tbb::task_arena arena(threads);
+  std::unique_ptr<pinning_observer> observer;
+  if (pin)
+    observer.reset(new pinning_observer(arena));
+  double best = 0.0;
+  for (int repeat=0; repeat<3; ++repeat) {
+    tbb::tick_count t0 = tbb::tick_count::now();
+    arena.execute([&] { k.run(size); });
+    double seconds = (tbb::tick_count::now() - t0).seconds();
+    if (repeat == 0 || seconds < best)
+      best = seconds;
+  }
+  return best;
+}
+
+void sweep(const std::string& name, const kernel& k, bool weak, int max_threads,
+  bool pin, std::ostream* csv) {
+  const char* mode = weak ? "weak" : "strong";
+  std::cout << name << ", " << mode << " scaling" << std::endl
+      << "  threads        size     seconds  speedup  efficiency" << std::endl;
+  std::vector<int> threads;
+  std::vector<double> speedup;
+  double t1 = 0.0;
+  for (int p=1; p<=max_threads; ++p) {
+    size_t size = weak ? k.base_size * p : k.base_size;
+    double t = time_kernel(k, size, p, pin);
+    if (p == 1)
+      t1 = t;
+    // Throughput relative to one thread
+    double s = t1 / t * (weak ? p : 1);
+    threads.push_back(p);
+    speedup.push_back(s);
+    std::cout << std::setw(9) << p << std::setw(12) << size << std::setw(12)
+        << std::setprecision(4) << t << std::setw(9) << s
+        << std::setw(12) << s / p << std::endl;
+    if (csv)
+      *csv << name << "," << mode << "," << p << "," << size << "," << t << ","
+          << s << "," << s / p << std::endl;
+  }
+
+  if (threads.size() < 2) {
+    std::cout << "  (fits need at least two thread counts)" << std::endl;
+    return;
+  }
+  fit amdahl = fit_scaling(threads, speedup, false);
+  fit usl = fit_scaling(threads, speedup, true);
+  std::cout << std::setprecision(3)
+      << "  Amdahl: sigma=" << amdahl.sigma << ", rms error " << amdahl.rms
+      << "; limit " << (amdahl.sigma > 0.0 ? 1.0 / amdahl.sigma : INFINITY) << std::endl
+      << "  USL:    sigma=" << usl.sigma << ", kappa=" << usl.kappa
+      << ", rms error " << usl.rms << std::endl;
+  if (usl.kappa > 0.0) {
+    double peak = std::max(1.0, std::sqrt(std::max(0.0, 1.0 - usl.sigma) / usl.kappa));
+    std::cout << "          peak at " << peak << " threads, speedup "
+        << usl_speedup(usl, peak) << std::endl;
+  } else {
+    std::cout << "          no coherency cost, no peak" << std::endl;
+  }
+  std::cout << "          predicted speedup " << usl_speedup(usl, 2.0 * max_threads)
+      << " at " << 2 * max_threads << " threads, " << usl_speedup(usl, 4.0 * max_threads)
+      << " at " << 4 * max_threads << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  register_kernels();
+
+  std::string kernel_list = "all", csv_name;
+  int max_threads = tbb::info::default_concurrency();
+  bool pin = false;
+  if (argc >= 2)
+    kernel_list = argv[1];
+  if (argc >= 3)
+    max_threads = std::stoi(argv[2]);
+  if (argc >= 4)
+    pin = std::string(argv[3]) == "pin";
+  if (argc >= 5)
+    csv_name = argv[4];
+  if (max_threads < 1) {
+    std::cerr << "Need at least one thread" << std::endl;
+    return 1;
+  }
+  if (pin && !pinning_observer::available())
+    std::cout << "Thread pinning is not available here, running unpinned" << std::endl;
+
+  std::vector<std::string> names;
+  if (kernel_list == "all") {
+    for (auto& k: registry())
+      names.push_back(k.first);
+  } else {
+    std::istringstream list(kernel_list);
+    std::string name;
+    while (std::getline(list, name, ',')) {
+      if (!registry().count(name)) {
+        std::cerr << "Unknown kernel " << name << ", the kernels are:";
+        for (auto& k: registry())
+          std::cerr << " " << k.first;
+        std::cerr << std::endl;
+        return 1;
+      }
+      names.push_back(name);
+    }
+  }
+
+  std::ofstream csv;
+  if (!csv_name.empty()) {
+    csv.open(csv_name);
+    if (!csv) {
+      std::cerr << "Failed to open " << csv_name << std::endl;
+      return 1;
+    }
+    csv << "kernel,mode,threads,size,seconds,speedup,efficiency" << std::endl;
+  }
+
+  // Time the work unit now, not in the first timed run of a spin kernel
+  workload::calibrate();
+
+  for (auto& name: names) {
+    for (bool weak: {false, true})
+      sweep(name, registry()[name], weak, max_threads, pin, csv_name.empty() ? nullptr : &csv);
+  }
+
+  return 0;
+}
@@ -0,0 +1,149 @@
+// Accuracy check for the vectorised maths library (src/common/simdmath.hpp)
+//
+// Every instruction set the CPU supports is checked in turn, measuring the
+// worst case error in ulp against the long double C library functions for
+// random arguments, plus the special values. Returns non-zero if any of the
+// documented bounds are exceeded.
+
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "simdmath.hpp"
+
+// Error of got in units of the last place of the (double) reference
+double ulp_error(double got, long double ref) {
+  double ref_d = double(ref);
+  if (std::isnan(got) && std::isnan(ref_d))
+    return 0.0;
+  if (got == ref_d)
+    return 0.0;
+  double ulp = std::nextafter(std::fabs(ref_d), INFINITY) - std::fabs(ref_d);
+  return double(std::fabs((long double)got - ref) / ulp);
+}
+
+// With in_place the batch works on a copy of x, with in == out
+template <typename Batch, typename Reference>
+double max_error(const std::vector<double>& x, Batch batch, Reference reference,
+  bool in_place = false) {
+  std::vector<double> out(x.size());
+  if (in_place) {
+    out = x;
+    batch(out.data(), out.data(), x.size());
+  } else {
+    batch(x.data(), out.data(), x.size());
+  }
+  double worst = 0.0;
+  for (size_t i=0; i<x.size(); ++i)
+    worst = std::max(worst, ulp_error(out[i], reference((long double)x[i])));
+  return worst;
+}
+
+// A special value matches the C library, including the sign of a NaN
+// (which printf shows); the double function is the reference for that, as
+// the long double ones give NaNs of the other sign
+bool special_ok(double got, long double ref, double ref_double) {
+  if (std::isnan(ref_double))
+    return std::isnan(got) && std::signbit(got) == std::signbit(ref_double);
+  return ulp_error(got, ref) <= 1.0;
+}
+
+int check(const char* name, double error, double bound) {
+  std::cout << "  " << name << ": " << error << " ulp (bound " << bound << ")";
+  if (error > bound) {
+    std::cout << " FAILED" << std::endl;
+    return 1;
+  }
+  std::cout << std::endl;
+  return 0;
+}
+
+int main() {
+  const size_t n = 200000;
+  std::mt19937_64 gen(20240301);
+  std::vector<double> x(n);
+  auto fill = [&](double lo, double hi) {
+    std::uniform_real_distribution<double> dist(lo, hi);
+    for (auto& v: x)
+      v = dist(gen);
+  };
+
+  int failures = 0;
+  simdmath::isa best = simdmath::active_isa();
+  for (int i=0; i<=int(best); ++i) {
+    simdmath::isa used = simdmath::set_isa(simdmath::isa(i));
+    std::cout << simdmath::isa_name(used) << " (" << simdmath::lanes() << " lanes)" << std::endl;
+
+    // log over the whole exponent range and then close to 1
+    fill(-700.0, 700.0);
+    for (auto& v: x)
+      v = std::exp(v);
+    auto log_batch = [](const double* in, double* out, size_t n) { simdmath::log(in, out, n); };
+    auto log_ref = [](long double v) { return std::log(v); };
+    failures += check("log", max_error(x, log_batch, log_ref), 1.0);
+    fill(0.5, 2.0);
+    failures += check("log near 1", max_error(x, log_batch, log_ref), 1.0);
+
+    fill(-708.0, 709.0);
+    failures += check("exp", max_error(x,
+      [](const double* in, double* out, size_t n) { simdmath::exp(in, out, n); },
+      [](long double v) { return std::exp(v); }), 1.0);
+
+    auto sin_batch = [](const double* in, double* out, size_t n) { simdmath::sin(in, out, n); };
+    auto sin_ref = [](long double v) { return std::sin(v); };
+    fill(-100.0, 100.0);
+    failures += check("sin", max_error(x, sin_batch, sin_ref), 2.5);
+    fill(-2e6, 2e6);
+    failures += check("sin large", max_error(x, sin_batch, sin_ref), 2.5);
+    failures += check("sin large in place", max_error(x, sin_batch, sin_ref, true), 2.5);
+
+    // The float versions always work in place on a double copy; their
+    // error is measured in float ulp
+    fill(-2e6, 2e6);
+    std::vector<float> xf(x.begin(), x.end()), outf(n);
+    simdmath::sin(xf.data(), outf.data(), n);
+    double worst_float = 0.0;
+    for (size_t j=0; j<n; ++j) {
+      float ref = float(std::sin((long double)xf[j]));
+      float ulp = std::nextafter(std::fabs(ref), INFINITY) - std::fabs(ref);
+      worst_float = std::max(worst_float, double(std::fabs(outf[j] - ref) / ulp));
+    }
+    failures += check("float sin large", worst_float, 1.0);
+
+    // Bound is 1 + 1.5|y log(x)| for the largest x used
+    const double y = 2.5;
+    fill(1.0, 40000.0);
+    failures += check("pow", max_error(x,
+      [y](const double* in, double* out, size_t n) { simdmath::pow(in, y, out, n); },
+      [y](long double v) { return std::pow(v, (long double)y); }),
+      1.0 + 1.5 * y * std::log(40000.0));
+
+    // Special values must match the C library
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    std::vector<double> special = {0.0, -1.0, INFINITY, -INFINITY, nan, 1e-310, 1000.0, -1000.0};
+    std::vector<double> out(special.size());
+    int bad = 0;
+    simdmath::log(special.data(), out.data(), special.size());
+    for (size_t j=0; j<special.size(); ++j)
+      if (!special_ok(out[j], std::log((long double)special[j]), std::log(special[j])))
+        ++bad;
+    simdmath::exp(special.data(), out.data(), special.size());
+    for (size_t j=0; j<special.size(); ++j)
+      if (!special_ok(out[j], std::exp((long double)special[j]), std::exp(special[j])))
+        ++bad;
+    simdmath::sin(special.data(), out.data(), special.size());
+    for (size_t j=0; j<special.size(); ++j)
+      if (!special_ok(out[j], std::sin((long double)special[j]), std::sin(special[j])))
+        ++bad;
+    failures += check("special values", bad, 0.0);
+  }
+
+  if (failures) {
+    std::cout << failures << " checks failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All checks passed" << std::endl;
+  return 0;
+}
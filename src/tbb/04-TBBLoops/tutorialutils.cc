@@ -1,17 +1,32 @@
 // Collection of a few useful functions for the TBB
 // concurrency tutorial
 
+#include <algorithm>
 #include <cmath>
 #include <chrono>
+#include <random>
+#include <utility>
+
+#include "simdmath.hpp"
+#include "tutorialutils.h"
 
 double burn(unsigned long iterations = 10'000'000lu) {
-  // Perform a time wasting bit of maths
+  // Perform a time wasting bit of maths, a chunk of values at a time
+  // so that the vectorised maths functions can be used
   // Use volatile to prevent the compiler from optimising away
   volatile double sum{0.0};
-  double f;
-  for (auto i = 0lu; i < iterations; ++i) {
-    f = (double)(i+1) / iterations * 1.414;
-    sum += std::sin(std::log(f));
+  const unsigned long chunk = 256;
+  double f[chunk];
+  for (auto i = 0lu; i < iterations; i += chunk) {
+    auto n = std::min(chunk, iterations - i);
+    for (auto j = 0lu; j < n; ++j)
+      f[j] = (double)(i+j+1) / iterations * 1.414;
+    simdmath::log(f, f, n);
+    simdmath::sin(f, f, n);
+    double chunk_sum{0.0};
+    for (auto j = 0lu; j < n; ++j)
+      chunk_sum += f[j];
+    sum += chunk_sum;
   }
   return sum;
 }
@@ -27,3 +42,163 @@ double burn_for(float ms_interval = 1.0) {
   return burn_result;
 }
 
+
+
+namespace workload {
+
+  namespace {
+
+    // The time of the fastest of a few runs of f
+    template <typename F>
+    double best_ns(F f, int repeats = 5) {
+      double best = 0.0;
+      for (int r = 0; r < repeats; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        auto stop = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+        if (r == 0 || ns < best)
+          best = ns;
+      }
+      return best;
+    }
+
+  } // anonymous namespace
+
+  double spin_units(unsigned long units) {
+    // One unit is a multiply and an add that depend on the last unit, so
+    // they can't be overlapped or vectorised. N.B. x must not start at
+    // the fixed point of the map, 1, or the compiler drops the loop
+    double x = 0.5;
+    for (auto i = 0lu; i < units; ++i)
+      x = x * 0.9999999 + 1e-7;
+    return x;
+  }
+
+  double calibrate() {
+    // Grow the run until it takes at least 2ms, then time the best of
+    // a few; thread safe as a function local static, which only runs once
+    static const double calibration = [] {
+      volatile double sink{0.0};
+      unsigned long units = 1000;
+      while (best_ns([&] { sink += spin_units(units); }, 1) < 2e6)
+        units *= 2;
+      return best_ns([&] { sink += spin_units(units); }) / units;
+    }();
+    return calibration;
+  }
+
+  double ns_per_unit() {
+    return calibrate();
+  }
+
+  unsigned long units_for(double ns) {
+    return ns > 0.0 ? (unsigned long)(ns / ns_per_unit() + 0.5) : 0lu;
+  }
+
+  double spin_ns(double ns) {
+    volatile double result = spin_units(units_for(ns));
+    return result;
+  }
+
+  const char* distribution_name(distribution d) {
+    switch (d) {
+      case distribution::uniform: return "uniform";
+      case distribution::bimodal: return "bimodal";
+      case distribution::pareto: return "pareto";
+      case distribution::skew: return "skew";
+    }
+    return "unknown";
+  }
+
+  bool parse_distribution(const std::string& name, distribution& d) {
+    for (auto candidate: all_distributions) {
+      if (name == distribution_name(candidate)) {
+        d = candidate;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<double> costs(distribution d, size_t n, double mean_ns, unsigned seed) {
+    std::vector<double> cost(n);
+    std::mt19937_64 generator(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    switch (d) {
+      case distribution::uniform:
+        for (auto& c: cost)
+          c = mean_ns * (0.5 + unit(generator));
+        break;
+      case distribution::bimodal: {
+        // 0.9 cheap + 0.1 * 10 cheap = 1.9 cheap on average
+        const double cheap = mean_ns / 1.9;
+        for (auto& c: cost)
+          c = unit(generator) < 0.1 ? 10.0 * cheap : cheap;
+        break;
+      }
+      case distribution::pareto: {
+        // Mean of Pareto(x_m, alpha) is alpha x_m / (alpha - 1), the cap
+        // takes a little off that
+        const double alpha = 1.5, x_m = mean_ns * (alpha - 1.0) / alpha;
+        for (auto& c: cost)
+          c = std::min(1000.0 * mean_ns, x_m / std::pow(1.0 - unit(generator), 1.0 / alpha));
+        break;
+      }
+      case distribution::skew:
+        for (size_t i = 0; i < n; ++i)
+          cost[i] = 2.0 * mean_ns * (i + 0.5) / n;
+        break;
+    }
+    return cost;
+  }
+
+  memory_work::memory_work(size_t bytes, unsigned seed):
+    m_data(std::max<size_t>(bytes / sizeof(double), 2)), m_next(m_data.size()) {
+    // Sattolo's shuffle makes a single cycle through all the elements
+    for (size_t i = 0; i < m_next.size(); ++i) {
+      m_data[i] = double(i % 1000) * 1e-3;
+      m_next[i] = uint32_t(i);
+    }
+    std::mt19937_64 generator(seed);
+    for (size_t i = m_next.size() - 1; i > 0; --i) {
+      std::uniform_int_distribution<size_t> pick(0, i - 1);
+      std::swap(m_next[i], m_next[pick(generator)]);
+    }
+
+    volatile double sink{0.0};
+    const size_t n = m_data.size(), hops = std::min<size_t>(n, 1 << 20);
+    m_ns_per_element = best_ns([&] { sink += stream(n, 0); }, 3) / n;
+    m_ns_per_hop = best_ns([&] { sink += chase(hops, 0); }, 3) / hops;
+  }
+
+  double memory_work::stream(size_t elements, size_t start) const {
+    const size_t n = m_data.size();
+    double sum{0.0};
+    start %= n;
+    while (elements > 0) {
+      size_t end = std::min(n, start + elements);
+      for (size_t i = start; i < end; ++i)
+        sum += m_data[i];
+      elements -= end - start;
+      start = 0;
+    }
+    return sum;
+  }
+
+  size_t memory_work::chase(size_t hops, size_t start) const {
+    size_t i = start % m_next.size();
+    for (size_t h = 0; h < hops; ++h)
+      i = m_next[i];
+    return i;
+  }
+
+  double memory_work::stream_ns(double ns, size_t start) const {
+    return stream(size_t(ns / m_ns_per_element + 0.5), start);
+  }
+
+  size_t memory_work::chase_ns(double ns, size_t start) const {
+    return chase(size_t(ns / m_ns_per_hop + 0.5), start);
+  }
+
+} // namespace workload
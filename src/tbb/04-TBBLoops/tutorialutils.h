@@ -1,7 +1,99 @@
 // Utilities for TBB tutorial
 
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifndef TUTORIAL_UTILS_H
+#define TUTORIAL_UTILS_H 1
+
 // Perform CPU burn maths calculations for a number of iterations
 double burn(unsigned long iterations);
 
 // Loop over the CPU burner until interval has expired (argument is in *milliseconds*)
 double burn_for(float ms_interval);
+
+// Synthetic workloads with a known cost
+//
+// burn() costs whatever the CPU and compiler make of it and burn_for()
+// reads the clock as it goes, which is a big overhead for short intervals.
+// Instead, a work unit here is a fixed chain of dependent floating point
+// operations, timed once against the steady clock, so that spin_ns(ns)
+// does a deterministic amount of work that takes about ns nanoseconds,
+// without reading the clock.
+namespace workload {
+
+  // Time the work unit, which takes a few tens of milliseconds; returns
+  // nanoseconds per unit. Programs that time spins call this at the
+  // start, so that the timing doesn't land inside a timed region, with
+  // every other thread waiting for it.
+  double calibrate();
+
+  // Nanoseconds per work unit, calibrating on the first call if
+  // calibrate() hasn't been called yet
+  double ns_per_unit();
+
+  // Do units work units; the result only depends on units
+  double spin_units(unsigned long units);
+
+  // Work units that take about ns nanoseconds
+  unsigned long units_for(double ns);
+
+  // Do about ns nanoseconds of work
+  double spin_ns(double ns);
+
+  // How the cost of the items of a loop is distributed
+  enum class distribution {
+    uniform,  // uniform in [mean/2, 3 mean/2]
+    bimodal,  // 90% cheap, 10% ten times the cost
+    pareto,   // heavy tail, Pareto with alpha 1.5, capped at 1000 mean
+    skew      // rising linearly with the index, from 0 to 2 mean
+  };
+
+  const distribution all_distributions[] = {distribution::uniform,
+    distribution::bimodal, distribution::pareto, distribution::skew};
+
+  const char* distribution_name(distribution d);
+
+  // Returns false if name is not a distribution
+  bool parse_distribution(const std::string& name, distribution& d);
+
+  // Cost in nanoseconds of each of n items, with the given mean; random
+  // distributions are reproducible from the seed
+  std::vector<double> costs(distribution d, size_t n, double mean_ns, unsigned seed = 42);
+
+  // Memory bound work over a buffer of a given size: streaming reads
+  // (bandwidth bound) and a pointer chase around a random cycle (latency
+  // bound). Both are timed when the buffer is made, so they can also be
+  // asked for by cost. N.B. the timing is of one long chase; many short,
+  // independent chases overlap in the CPU and go faster.
+  class memory_work {
+  private:
+    std::vector<double> m_data;
+    std::vector<uint32_t> m_next;
+    double m_ns_per_element;
+    double m_ns_per_hop;
+
+  public:
+    memory_work(size_t bytes, unsigned seed = 42);
+
+    size_t size() const { return m_data.size(); }
+
+    // Sum of elements values from start, wrapping around the buffer
+    double stream(size_t elements, size_t start) const;
+
+    // Follow hops links of the cycle from start; returns where it ends
+    size_t chase(size_t hops, size_t start) const;
+
+    double ns_per_element() const { return m_ns_per_element; }
+    double ns_per_hop() const { return m_ns_per_hop; }
+
+    // As stream and chase, for about ns nanoseconds
+    double stream_ns(double ns, size_t start) const;
+    size_t chase_ns(double ns, size_t start) const;
+  };
+
+} // namespace workload
+
+#endif  // TUTORIAL_UTILS_H
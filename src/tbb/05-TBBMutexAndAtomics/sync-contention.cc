@@ -0,0 +1,258 @@
+// Benchmark of the ways of accumulating a shared sum, on equal terms
+//
+// sync-contention [SIZE] [MAX_THREADS] [CSV FILE]
+//
+// The multithread-tbb-sum examples each count the occupancy of a detector
+// (the number of positive cells) one way. Here the same count is done by
+// every method, for 1, 2, 4, ... MAX_THREADS threads (default, the number
+// of cores) and for a range of update frequencies: the cells are taken in
+// blocks of EVERY cells, each counted locally, then added to the shared
+// total, so EVERY=1 is one update per cell and the most contention.
+//
+// The methods are:
+//   std::mutex, tbb::spin_mutex, tbb::queuing_mutex and
+//   tbb::speculative_spin_mutex (which needs hardware transactional memory
+//   to speculate, otherwise it's a spin_mutex) around a plain total
+//   std::atomic fetch_add, with each memory order
+//   tbb::combinable and tbb::enumerable_thread_specific, with a local total
+//   for each thread that are combined at the end
+//   tbb::parallel_reduce, where the totals are joined up the task tree
+//
+// For each run it reports the throughput (updates and cells per second)
+// and the fairness, Jain's index of the number of updates made by each
+// thread, (sum x)^2 / (n sum x^2), which is 1 when all threads made the
+// same number and 1/n when one thread made them all. SIZE is the number
+// of cells (default 10 million). The program fails if any method gets the
+// wrong answer. One line per run goes to CSV FILE, if given.
+//
+// N.B. with more threads than cores, queuing_mutex hands the lock on in
+// order to threads that may not be running, so it becomes very slow (a
+// lock convoy).
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "tbb/tbb.h"
+
+void fill_detector(std::vector<float> &det, size_t n) {
+  std::default_random_engine generator;
+  std::uniform_real_distribution<float> distribution(-0.2,1.0);
+
+  det.clear();
+  det.reserve(n);
+
+  for (size_t i=0; i<n; ++i)
+    det.push_back(distribution(generator));
+}
+
+size_t serial_occupancy(const std::vector<float> &det) {
+  size_t sum=0;
+  for (auto& el: det) {
+    if (el > 0.0f) {
+      ++sum;
+    }
+  }
+  return sum;
+}
+
+// Number of updates made by each thread
+typedef tbb::enumerable_thread_specific<size_t> update_counts;
+
+// Count the cells of det in blocks of every cells, passing each block's
+// count to update
+template <typename Update>
+void occupancy_loop(const std::vector<float>& det, size_t every, Update update) {
+  const float* cells = det.data();
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, det.size()),
+    [=](const tbb::blocked_range<size_t>& r) {
+      for (size_t b=r.begin(); b<r.end(); b+=every) {
+        size_t e = std::min(r.end(), b + every), local = 0;
+        for (size_t i=b; i<e; ++i)
+          if (cells[i] > 0.0f) ++local;
+        update(local);
+      }
+    });
+}
+
+// The lock guard for each mutex type
+template <typename Mutex> struct guard {
+  typedef typename Mutex::scoped_lock type;
+};
+
+template <> struct guard<std::mutex> {
+  typedef std::lock_guard<std::mutex> type;
+};
+
+template <typename Mutex>
+size_t count_locked(const std::vector<float>& det, size_t every, update_counts& updates) {
+  Mutex mtx;
+  size_t occupancy = 0;
+  occupancy_loop(det, every, [&](size_t local) {
+    typename guard<Mutex>::type lock(mtx);
+    occupancy += local;
+    ++updates.local();
+  });
+  return occupancy;
+}
+
+template <std::memory_order Order>
+size_t count_atomic(const std::vector<float>& det, size_t every, update_counts& updates) {
+  std::atomic<size_t> occupancy{0};
+  occupancy_loop(det, every, [&](size_t local) {
+    occupancy.fetch_add(local, Order);
+    ++updates.local();
+  });
+  return occupancy.load();
+}
+
+size_t count_combinable(const std::vector<float>& det, size_t every, update_counts& updates) {
+  tbb::combinable<size_t> occupancy([] { return size_t(0); });
+  occupancy_loop(det, every, [&](size_t local) {
+    occupancy.local() += local;
+    ++updates.local();
+  });
+  return occupancy.combine(std::plus<size_t>());
+}
+
+size_t count_ets(const std::vector<float>& det, size_t every, update_counts& updates) {
+  tbb::enumerable_thread_specific<size_t> occupancy(0);
+  occupancy_loop(det, every, [&](size_t local) {
+    occupancy.local() += local;
+    ++updates.local();
+  });
+  return occupancy.combine(std::plus<size_t>());
+}
+
+size_t count_reduce(const std::vector<float>& det, size_t every, update_counts& updates) {
+  const float* cells = det.data();
+  return tbb::parallel_reduce(tbb::blocked_range<size_t>(0, det.size()), size_t(0),
+    [=, &updates](const tbb::blocked_range<size_t>& r, size_t running) {
+      for (size_t b=r.begin(); b<r.end(); b+=every) {
+        size_t e = std::min(r.end(), b + every), local = 0;
+        for (size_t i=b; i<e; ++i)
+          if (cells[i] > 0.0f) ++local;
+        running += local;
+        ++updates.local();
+      }
+      return running;
+    }, std::plus<size_t>());
+}
+
+struct method {
+  const char* name;
+  std::function<size_t(const std::vector<float>&, size_t, update_counts&)> count;
+};
+
+const std::vector<method>& methods() {
+  static const std::vector<method> all = {
+    {"std::mutex", count_locked<std::mutex>},
+    {"spin_mutex", count_locked<tbb::spin_mutex>},
+    {"queuing_mutex", count_locked<tbb::queuing_mutex>},
+    {"speculative_spin_mutex", count_locked<tbb::speculative_spin_mutex>},
+    {"atomic relaxed", count_atomic<std::memory_order_relaxed>},
+    {"atomic acquire", count_atomic<std::memory_order_acquire>},
+    {"atomic release", count_atomic<std::memory_order_release>},
+    {"atomic acq_rel", count_atomic<std::memory_order_acq_rel>},
+    {"atomic seq_cst", count_atomic<std::memory_order_seq_cst>},
+    {"combinable", count_combinable},
+    {"enumerable_thread_specific", count_ets},
+    {"parallel_reduce", count_reduce}
+  };
+  return all;
+}
+
+// Jain's fairness index of the updates made by the threads that took part
+// in the run (n threads, but some may have made none)
+double fairness(const update_counts& updates, int threads) {
+  double sum = 0.0, sum2 = 0.0;
+  for (auto u: updates) {
+    sum += u;
+    sum2 += double(u) * u;
+  }
+  return sum2 > 0.0 ? sum * sum / (threads * sum2) : 1.0;
+}
+
+int main(int argc, char* argv[]) {
+  size_t size = 10000000;
+  int max_threads = tbb::info::default_concurrency();
+  std::string csv_name;
+  if (argc >= 2)
+    size = std::stoul(argv[1]);
+  if (argc >= 3)
+    max_threads = std::stoi(argv[2]);
+  if (argc >= 4)
+    csv_name = argv[3];
+  if (size == 0 || max_threads < 1) {
+    std::cerr << "Need at least one cell and one thread" << std::endl;
+    return 1;
+  }
+
+  std::ofstream csv;
+  if (!csv_name.empty()) {
+    csv.open(csv_name);
+    if (!csv) {
+      std::cerr << "Failed to open " << csv_name << std::endl;
+      return 1;
+    }
+    csv << "method,threads,every,seconds,updates_per_s,cells_per_s,fairness" << std::endl;
+  }
+
+  std::vector<float> det;
+  fill_detector(det, size);
+  const size_t expected = serial_occupancy(det);
+  std::cout << "Occupancy is " << expected << " of " << size << " cells" << std::endl;
+
+  std::vector<int> thread_counts;
+  for (int t=1; t<max_threads; t*=2)
+    thread_counts.push_back(t);
+  thread_counts.push_back(max_threads);
+
+  bool ok = true;
+  for (int threads: thread_counts) {
+    tbb::global_control control(tbb::global_control::max_allowed_parallelism, threads);
+    tbb::task_arena arena(threads);
+    for (size_t every: {1, 16, 256, 4096}) {
+      std::cout << std::endl << threads << " threads, an update every " << every
+          << " cells" << std::endl
+          << std::setw(28) << "method" << std::setw(12) << "seconds"
+          << std::setw(14) << "Mupdates/s" << std::setw(12) << "Mcells/s"
+          << std::setw(10) << "fairness" << std::endl;
+      for (auto& m: methods()) {
+        update_counts updates(0);
+        size_t occupancy = 0;
+        tbb::tick_count t0 = tbb::tick_count::now();
+        arena.execute([&] { occupancy = m.count(det, every, updates); });
+        double seconds = (tbb::tick_count::now() - t0).seconds();
+        size_t total_updates = updates.combine(std::plus<size_t>());
+        double fair = fairness(updates, threads);
+        std::cout << std::setw(28) << m.name << std::setprecision(4)
+            << std::setw(12) << seconds
+            << std::setw(14) << total_updates / seconds * 1e-6
+            << std::setw(12) << size / seconds * 1e-6
+            << std::setw(10) << fair;
+        if (occupancy != expected) {
+          std::cout << "  WRONG, got " << occupancy;
+          ok = false;
+        }
+        std::cout << std::endl;
+        if (csv)
+          csv << m.name << "," << threads << "," << every << "," << seconds << ","
+              << total_updates / seconds << "," << size / seconds << "," << fair << std::endl;
+      }
+    }
+  }
+
+  if (!ok) {
+    std::cerr << "Some methods got the wrong occupancy" << std::endl;
+    return 1;
+  }
+  return 0;
+}
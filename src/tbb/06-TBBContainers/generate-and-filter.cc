@@ -1,16 +1,32 @@
+// Generate random data in parallel, then filter out the positive values,
+// first by pushing them onto a concurrent_vector (fast to write, but it
+// serialises on the growth of the vector and scrambles the order), then by
+// an order preserving parallel compaction (see compact.hpp), which is
+// checked against std::copy_if. The data go in a std::vector, which is
+// sized up front so each task writes its own part: the compaction's SIMD
+// kernels need contiguous input, which a concurrent_vector's segments are
+// not (see concurrent-vector-grow-by.cc for filling one of those).
+//
+// generate-and-filter [SIZE] [GRAIN]
+
+#include <algorithm>
 #include <iostream>
+#include <iterator>
 #include <random>
 #include <chrono>
 #include <thread>
+#include <vector>
 
 #include "tbb/tbb.h"
 
+#include "compact.hpp"
+
 static size_t default_size = 100000000;
 static size_t default_grain_size = 0;
 
 class filler {
 private:
-  tbb::concurrent_vector<float> *const my_vector;
+  float *const my_data;
   
 public:
   void operator() (tbb::blocked_range<size_t>& r) const {
@@ -22,33 +38,33 @@ public:
     std::default_random_engine generator(seed);
     std::uniform_real_distribution<float> distribution(-100.0, 1.0);
     
-    auto insert_range_iterator = (*my_vector).grow_by(r.size());
-    for (size_t count=0; count<r.size(); ++count) {
-      *insert_range_iterator++ = distribution(generator);
+    for (size_t i=r.begin(); i!=r.end(); ++i) {
+      my_data[i] = distribution(generator);
     }
   }
 
-  filler(tbb::concurrent_vector<float> *input_data_vector):
-    my_vector{input_data_vector}
+  filler(float *input_data):
+    my_data{input_data}
   {}
   
 };
 
 class filter {
 private:
-  tbb::concurrent_vector<float> *const my_input_vector, *const my_filtered_vector;
+  const float *const my_input_data;
+  tbb::concurrent_vector<float> *const my_filtered_vector;
   
 public:
   void operator() (tbb::blocked_range<size_t>& r) const {
     for(size_t i=r.begin(); i!=r.end(); ++i) {
-      if ((*my_input_vector)[i] > 0.0) {
-	(*my_filtered_vector).push_back((*my_input_vector)[i]);
+      if (my_input_data[i] > 0.0) {
+	(*my_filtered_vector).push_back(my_input_data[i]);
       }
     }
   }
 
-  filter(tbb::concurrent_vector<float> *input_data_vector, tbb::concurrent_vector<float> *output_filtered_vector):
-    my_input_vector{input_data_vector}, my_filtered_vector{output_filtered_vector}
+  filter(const float *input_data, tbb::concurrent_vector<float> *output_filtered_vector):
+    my_input_data{input_data}, my_filtered_vector{output_filtered_vector}
   {}
 };
 
@@ -72,25 +88,44 @@ int main(int argc, char *argv[]) {
     my_grain_size = atoi(argv[2]);
   }
 
-  tbb::concurrent_vector<float> data_vector, filtered_vector;
+  std::vector<float> data(my_size);
+  tbb::concurrent_vector<float> filtered_vector;
   
   std::cout << "Target data array size is " << my_size << "; Grain size is " << my_grain_size << std::endl;
 
   tbb::tick_count t0 = tbb::tick_count::now();
-  tbb::parallel_for(tbb::blocked_range<size_t>(0, my_size, my_grain_size), filler(&data_vector));
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, my_size, my_grain_size), filler(data.data()));
   tbb::tick_count t1 = tbb::tick_count::now();
   auto tick_interval = t1-t0;
 
   std::cout << "Filler took " << tick_interval.seconds() << "s" << std::endl;
-  print_vec(data_vector, false);
+  std::cout << "There were " << data.size() << " elements" << std::endl;
 
   t0 = tbb::tick_count::now();
-  tbb::parallel_for(tbb::blocked_range<size_t>(0, my_size, my_grain_size), filter(&data_vector, &filtered_vector));
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, my_size, my_grain_size), filter(data.data(), &filtered_vector));
   t1 = tbb::tick_count::now();
   tick_interval = t1-t0;
   
   std::cout << "Filter took " << tick_interval.seconds() << "s" << std::endl;  
   print_vec(filtered_vector, false);
 
+  t0 = tbb::tick_count::now();
+  std::vector<float> compacted = compact::copy_if(data.data(), data.size(),
+    compact::greater<float>{0.0f});
+  t1 = tbb::tick_count::now();
+  tick_interval = t1-t0;
+
+  std::cout << "Compaction took " << tick_interval.seconds() << "s" << std::endl;
+  std::cout << "There were " << compacted.size() << " elements" << std::endl;
+
+  std::vector<float> expected;
+  std::copy_if(data.begin(), data.end(), std::back_inserter(expected),
+    [](float x) { return x > 0.0f; });
+  if (compacted != expected || compacted.size() != filtered_vector.size()) {
+    std::cerr << "Compaction differs from the serial copy_if" << std::endl;
+    return 1;
+  }
+  std::cout << "Compaction is in order and matches the serial copy_if" << std::endl;
+
   return 0;
 }
@@ -1,79 +1,217 @@
+// Pipeline of reading numbers, a maths transform and writing the answers
+//
+// maths-pipeline [TOKENS] [BATCH_SIZE]
+//
+// Reads input.txt (made by gen-input) and writes output.txt. TOKENS
+// (default 10) batches of BATCH_SIZE (default 4000) records can be in
+// flight at once.
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
 #include <iostream>
 #include <cstdio>
+#include <cstring>
 #include <cmath>
+#include <string>
+#include <system_error>
+#include <vector>
 #include <tbb/tbb.h>
 
+#include "simdmath.hpp"
+
+// Records are passed through the pipeline in batches, so that the
+// transform can evaluate the maths for a whole batch at once, and the
+// reader and writer only make one system call for many records
+typedef std::vector<double> record_batch;
+
+// Reads the input in large blocks and parses numbers, one per line, with
+// std::from_chars; a number cut off at the end of a block is kept for the
+// next one. The reader is a serial filter, so its state is only ever used
+// by one thread at a time.
 class DataReader {
 private:
   FILE *my_input;
- 
+  size_t my_batch_size;
+  mutable std::vector<char> my_buffer;
+  mutable size_t my_begin, my_end;
+  mutable bool my_eof;
+
+  static bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+  }
+
+  // Move what's left to the front of the buffer and read more after it;
+  // returns false at the end of the input
+  bool refill() const {
+    if (my_eof)
+      return false;
+    std::memmove(my_buffer.data(), my_buffer.data() + my_begin, my_end - my_begin);
+    my_end -= my_begin;
+    my_begin = 0;
+    if (my_end == my_buffer.size())
+      my_buffer.resize(2 * my_buffer.size());
+    size_t got = fread(my_buffer.data() + my_end, 1, my_buffer.size() - my_end, my_input);
+    my_end += got;
+    if (got == 0)
+      my_eof = true;
+    return got > 0;
+  }
+
 public:
-  DataReader(FILE* in):
-    my_input{in} {};
+  static const size_t block_size = 1 << 20;
+
+  DataReader(FILE* in, size_t batch_size):
+    my_input{in}, my_batch_size{batch_size}, my_buffer(block_size),
+    my_begin{0}, my_end{0}, my_eof{false} {};
 
   DataReader(const DataReader& a):
-    my_input{a.my_input} {};
+    my_input{a.my_input}, my_batch_size{a.my_batch_size}, my_buffer(a.my_buffer),
+    my_begin{a.my_begin}, my_end{a.my_end}, my_eof{a.my_eof} {};
 
   ~DataReader() {};
 
-  double operator()(tbb::flow_control& fc) const {
-    double number=-1.0;
-    int rc = fscanf(my_input, "%lf\n", &number);
+  record_batch operator()(tbb::flow_control& fc) const {
+    record_batch batch;
+    batch.reserve(my_batch_size);
+    while (batch.size() < my_batch_size) {
+      // Skip blank space, which can also start the next block, so only
+      // stop when the input is used up
+      while (true) {
+        while (my_begin < my_end && is_space(my_buffer[my_begin]))
+          ++my_begin;
+        if (my_begin < my_end || !refill())
+          break;
+      }
+      if (my_begin == my_end)
+        break;
+      // Find the end of the number, reading more if it runs off the end
+      size_t token_end = my_begin;
+      while (true) {
+        while (token_end < my_end && !is_space(my_buffer[token_end]))
+          ++token_end;
+        if (token_end < my_end || my_eof)
+          break;
+        token_end -= my_begin;
+        refill();
+        token_end += my_begin;
+      }
+      double number=-1.0;
+      const char* first = my_buffer.data() + my_begin;
+      const char* last = my_buffer.data() + token_end;
+      auto result = std::from_chars(first, last, number);
+      if (result.ec != std::errc() || result.ptr != last) {
+        std::cerr << "Bad input record \"" << std::string(first, last) << "\"" << std::endl;
+        my_begin = my_end;
+        my_eof = true;
+        break;
+      }
 #ifdef DEBUG
-    std::cout << "input " << rc << " " << number << std::endl;
+      std::cout << "input " << number << std::endl;
 #endif
-    if (rc != 1) {
-      fc.stop();
-      return 0.0;
+      batch.push_back(number);
+      my_begin = token_end;
     }
-    return number;
+    if (batch.empty())
+      fc.stop();
+    return batch;
   }
 };
 
 
 class Transform {
 public:
-  double operator()(double const number) const {
+  // For each positive number iterate
+  //   answer += pow(log(number+answer)+1.0, 2.5)
+  // with all of the batch's records going through the vectorised
+  // maths functions together
+  record_batch operator()(record_batch numbers) const {
 #ifdef DEBUG
-    std::cout << "Running transform " << number << std::endl;
+    std::cout << "Running transform on " << numbers.size() << " records" << std::endl;
 #endif
-    double answer=0.0;
-    if (number > 0.0)
-      for (int i=0; i<1000; ++i)
-	answer += pow(log(number+answer)+1.0, 2.5);
-    return answer;
+    std::vector<size_t> index;
+    for (size_t i=0; i<numbers.size(); ++i)
+      if (numbers[i] > 0.0)
+        index.push_back(i);
+    std::vector<double> answer(index.size(), 0.0), tmp(index.size());
+    for (int i=0; i<1000; ++i) {
+      for (size_t j=0; j<index.size(); ++j)
+        tmp[j] = numbers[index[j]] + answer[j];
+      simdmath::log(tmp.data(), tmp.data(), tmp.size());
+      for (auto& t: tmp)
+        t += 1.0;
+      simdmath::pow(tmp.data(), 2.5, tmp.data(), tmp.size());
+      for (size_t j=0; j<index.size(); ++j)
+        answer[j] += tmp[j];
+    }
+    record_batch answers(numbers.size(), 0.0);
+    for (size_t j=0; j<index.size(); ++j)
+      answers[index[j]] = answer[j];
+    return answers;
   }
 };
 
+// Formats a batch of answers as "%lf\n" would, with std::to_chars into a
+// buffer that is reused, then writes them all at once. A short write is
+// reported once and sets write_failed, which main checks.
 class DataWriter {
 private:
   FILE* my_output;
+  mutable std::vector<char> my_buffer;
+  bool& my_write_failed;
+
+  void flush(size_t n) const {
+    if (my_write_failed)
+      return;
+    if (fwrite(my_buffer.data(), 1, n, my_output) != n) {
+      std::cerr << "Failed to write output: " << std::strerror(errno) << std::endl;
+      my_write_failed = true;
+    }
+  }
 
 public:
-  DataWriter(FILE* out):
-    my_output{out} {};
+  // Room for any one answer, as fixed point doubles run to 300+ digits
+  static const size_t max_record = 512;
+
+  DataWriter(FILE* out, size_t batch_size, bool& write_failed):
+    my_output{out}, my_buffer(std::max<size_t>(batch_size * 24, 2 * max_record)),
+    my_write_failed(write_failed) {};
 
   DataWriter(const DataWriter& a):
-    my_output{a.my_output} {};
+    my_output{a.my_output}, my_buffer(a.my_buffer.size()),
+    my_write_failed(a.my_write_failed) {};
 
   ~DataWriter() {};
 
-  void operator()(double const answer) const {
+  void operator()(record_batch const answers) const {
+    char* const begin = my_buffer.data();
+    char* const end = begin + my_buffer.size();
+    char* p = begin;
+    for (auto answer: answers) {
 #ifdef DEBUG
-    std::cout << "Output " << answer << "(" << my_output << ")" << std::endl;
+      std::cout << "Output " << answer << "(" << my_output << ")" << std::endl;
 #endif
-    fprintf(my_output, "%lf\n", answer);
+      if (end - p < std::ptrdiff_t(max_record)) {
+        flush(p - begin);
+        p = begin;
+      }
+      p = std::to_chars(p, end, answer, std::chars_format::fixed, 6).ptr;
+      *p++ = '\n';
+    }
+    flush(p - begin);
   }
 };
 
 
-void runFilter(int ntoken, FILE* input_file, FILE* output_file) {
+void runFilter(int ntoken, size_t batch_size, FILE* input_file, FILE* output_file,
+  bool& write_failed) {
   tbb::parallel_pipeline(ntoken,
-    tbb::make_filter<void, double>(tbb::filter::serial_in_order, DataReader(input_file))
+    tbb::make_filter<void, record_batch>(tbb::filter_mode::serial_in_order, DataReader(input_file, batch_size))
     &
-    tbb::make_filter<double, double>(tbb::filter::parallel, Transform())
+    tbb::make_filter<record_batch, record_batch>(tbb::filter_mode::parallel, Transform())
     &
-    tbb::make_filter<double, void>(tbb::filter::serial_in_order, DataWriter(output_file))
+    tbb::make_filter<record_batch, void>(tbb::filter_mode::serial_in_order, DataWriter(output_file, batch_size, write_failed))
     );
 }
 
@@ -84,10 +222,18 @@ int main(int argc, char* argv[]) {
   const char out_file[] = "output.txt";
 
   int ntoken = 10;
-  if (argc == 2)
+  size_t batch_size = 4000;
+  if (argc >= 2)
     ntoken = atoi(argv[1]);
+  if (argc >= 3)
+    batch_size = std::stoul(argv[2]);
+  if (ntoken < 1 || batch_size == 0) {
+    std::cerr << "Need at least one token and one record per batch" << std::endl;
+    return 1;
+  }
 
-  std::cout << "Running pipeline with " << ntoken << " tokens" << std::endl;
+  std::cout << "Running pipeline with " << ntoken << " tokens of "
+      << batch_size << " records" << std::endl;
 
   FILE* in = fopen(in_file, "r");
   if (!in) {
@@ -96,20 +242,27 @@ int main(int argc, char* argv[]) {
   }
   FILE* out = fopen(out_file, "w");
   if (!out) {
-    std::cerr << "Failed to open input file " << in_file << std::endl;
+    std::cerr << "Failed to open output file " << out_file << std::endl;
     return 1;
   }
 
   auto t0 = tbb::tick_count::now();
 
-  runFilter(ntoken, in, out);
+  bool write_failed = false;
+  runFilter(ntoken, batch_size, in, out, write_failed);
 
   auto t1 = tbb::tick_count::now();
   auto parallel_tick_interval = t1-t0;
   std::cout << "Pipeline took " << parallel_tick_interval.seconds() << "s" << std::endl;
 
-  std::cout << "Success" << std::endl;
-
   fclose(in);
-  fclose(out);
+  if (fclose(out) != 0 && !write_failed) {
+    std::cerr << "Failed to write output: " << std::strerror(errno) << std::endl;
+    write_failed = true;
+  }
+  if (write_failed)
+    return 1;
+
+  std::cout << "Success" << std::endl;
+  return 0;
 }
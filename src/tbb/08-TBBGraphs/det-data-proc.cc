@@ -2,40 +2,44 @@
 #include <fstream>
 #include <cstdlib>
 #include <ctime>
-#include <memory>
-#include <mutex>
+#include <functional>
 
+#include "histogram.hpp"
+#include "routing.hpp"
 #include "stripdet.hpp"
+#include "stripfile.hpp"
+#include "stripparse.hpp"
 
 #include "tbb/tbb.h"
 #include "tbb/flow_graph.h"
 
-using std::shared_ptr;
-using std::make_shared;
-
 using std::cout;
 using std::endl;
 
 
-// Strip loaded is a class which is instantiated from a ifstream pointer
-// and a counter reference. When called by TBB, it will assign a read
-// strip to a shared pointer and increment the counter.
-// N.B. Source nodes are never called in parallel, so no need to protect
+// Strip loader is a class which is instantiated from a strip source,
+// either a set of strips already loaded into memory or a mapped binary
+// strip file, and a counter reference. When called by TBB, it will return
+// a view of the next strip and increment the counter.
+// N.B. Input nodes are never called in parallel, so no need to protect
 // the counter.
 class strip_loader {
 private:
   size_t& m_strip_counter;
-  std::ifstream* m_input_stream_p;
+  size_t m_n_strips;
+  std::function<strip_view(size_t)> m_get_strip;
 public:
-  strip_loader(std::ifstream* ifs_p, size_t& strip_counter):
-    m_strip_counter{strip_counter}, m_input_stream_p(ifs_p) {};
-
-  bool operator() (shared_ptr<det_strip>& ds_p) {
-    ds_p = make_shared<det_strip> ();
-    bool rc = ds_p->load_strip(*m_input_stream_p);
-    if (rc)
-      ++m_strip_counter;
-    return rc;
+  template <typename StripSource>
+  strip_loader(const StripSource& strips, size_t& strip_counter):
+    m_strip_counter{strip_counter}, m_n_strips{strips.size()},
+    m_get_strip{[&strips](size_t i) { return strips[i]; }} {};
+
+  strip_view operator() (tbb::flow_control& fc) {
+    if (m_strip_counter >= m_n_strips) {
+      fc.stop();
+      return strip_view{};
+    }
+    return m_get_strip(m_strip_counter++);
   }
 
   size_t strip_counter() {
@@ -45,129 +49,124 @@ public:
 
 // Simple counter class that increments the referenced counter
 // when called. As TBB will copy construct us, we need to use
-// a reference and to protect increments with a mutex.
-std::mutex fooble_mtx;
+// a reference; each thread counts in its own slot, so no locking
+// is needed, and the slots are summed at the end.
+typedef tbb::enumerable_thread_specific<size_t> thread_counter;
 class fooble_counter {
 private:
-  size_t& m_fooble_counter;
+  thread_counter& m_fooble_counter;
 public:
-  fooble_counter(size_t& fooble_counter):
+  fooble_counter(thread_counter& fooble_counter):
     m_fooble_counter{fooble_counter} {};
 
   bool operator() (bool fbl) {
-    if (fbl) {
-      std::lock_guard<std::mutex> fooble_lock(fooble_mtx);
-      ++m_fooble_counter;
-    }
+    if (fbl)
+      ++m_fooble_counter.local();
     return true;
   }
 };
 
-// Trivial histograming class that will give a data quality and
-// signal histogram for strips. We pass one _reference_ to TBB
-// graph, so that the accumulation happens in the single instance
-// that we have. Thus filling has to be protected with a mutex.
-std::mutex dq_fill_mtx;
+// Data quality and signal histograms for strips, as a function of
+// strip position. The histograms are thread local, so the graph can
+// fill them from many threads at once without any locking.
 class dq_hist {
 private:
-  float m_start;
-  float m_end;
-  size_t m_bins;
-  std::vector<size_t> m_counts;
-  std::vector<float> m_dq;
-  std::vector<size_t> m_signal;
-
-  size_t get_bin(float x) {
-    long bin = ((x - m_start) / (m_end - m_start)) * m_bins;
-    if (bin < 0)
-      return 0;
-    if (bin >= m_bins)
-      return m_bins-1;
-    return bin;
-  }	     
+  hist::histogram<1> m_dq;
+  hist::histogram<1> m_signal;
 
 public:
   dq_hist(float start, float end, size_t bins):
-    m_start{start}, m_end{end}, m_bins{bins}
-  {
-    m_counts.assign(m_bins, 0);
-    m_dq.assign(m_bins, 0.0);
-    m_signal.assign(m_bins, 0.0);
-  };
-
-  tbb::flow::continue_msg operator() (const shared_ptr<det_strip>& ds_p) {
-    fill(ds_p->position(), ds_p->data_quality(), ds_p->signal());
-    return tbb::flow::continue_msg{};
-  }
+    m_dq{hist::axis(bins, start, end)},
+    m_signal{hist::axis(bins, start, end)} {};
 
   void fill(float x, float dq, float signal) {
-    size_t bin = get_bin(x);
-    {
-      std::lock_guard<std::mutex> dq_fill_lock(dq_fill_mtx);
-      ++m_counts[bin];
-      m_dq[bin] += dq;
-      m_signal[bin] += signal;
-    }
+    m_dq.fill(x, dq);
+    m_signal.fill(x, signal);
   }
 
   void write_hist(std::ostream& ofs) {
+    auto dq = m_dq.merged();
+    auto signal = m_signal.merged();
     ofs << "Bin DQ Signal" << endl;
-    for (size_t i=0; i<m_bins; ++i) {
-      ofs << i << " ";
-      if (m_counts[i] == 0) {
+    for (size_t i=1; i<=dq.get_axis().bins(); ++i) {
+      ofs << i-1 << " ";
+      size_t counts = dq.entries({{i}});
+      if (counts == 0) {
         ofs << 0.0 << " " << 0.0 << endl;
       } else {
-        ofs << m_dq[i]/m_counts[i] << " " << m_signal[i]/m_counts[i] << endl;
+        ofs << dq.sum_w({{i}})/counts << " " << signal.sum_w({{i}})/counts << endl;
       }
     }
   }
 };
 
 
-int main() {
+int main(int argc, char* argv[]) {
   tbb::flow::graph g;
 
-  std::ifstream det_input("fooble.txt", std::ofstream::out);
+  // Input can be a text strip file or a binary one (see det-txt2bin)
+  const char* input_file = "fooble.txt";
+  if (argc == 2)
+    input_file = argv[1];
 
   // These variables/objects are ones that we need to have as 
   // singletons, so we construct them outside the graph, then 
   // pass then to TBB by reference
   size_t total_strips = 0;
-  size_t counted_foobles = 0;
+  thread_counter counted_foobles(0);
   dq_hist my_dq(0.0, 1.0, 10);
 
-  tbb::flow::source_node<shared_ptr<det_strip>> loader(g, strip_loader(&det_input, total_strips), false);
-  tbb::flow::function_node<shared_ptr<det_strip>, shared_ptr<det_strip>> 
-    calculate_dq(g, tbb::flow::unlimited, [](const shared_ptr<det_strip> ds_p) {
-      float dq = ds_p->data_quality();
-      return ds_p;
-    });
-  tbb::flow::function_node<shared_ptr<det_strip>, shared_ptr<det_strip>> get_signal(g, tbb::flow::unlimited, [](const shared_ptr<det_strip> ds_p) {
-      float signal = ds_p->signal();
-      return ds_p;
+  // A binary file is just mapped into memory, a text file is loaded
+  // into one contiguous set of strips. Either way the graph passes
+  // around lightweight views into the strip data.
+  strip_file mapped_strips;
+  strip_set strips;
+  bool binary_input = mapped_strips.open(input_file);
+  if (!binary_input && load_strips_parallel(input_file, strips) == 0) {
+    std::cerr << "Failed to load any strips from " << input_file << endl;
+    return 1;
+  }
+
+  tbb::flow::input_node<strip_view> loader(g, binary_input ?
+    strip_loader(mapped_strips, total_strips) : strip_loader(strips, total_strips));
+  // Each strip is analysed in one pass (data quality, signal and, only
+  // for strips passing the data quality cut, the expensive fooble
+  // trigger). Every result fills the histograms, but only the results
+  // where the fooble trigger was evaluated are routed on to be counted.
+  const double dq_cut = 0.9;
+  tbb::flow::function_node<strip_view, strip_result> analyse_strip(g, tbb::flow::unlimited,
+    [dq_cut](strip_view sv) {
+      return sv.analyse(dq_cut);
     });
-  tbb::flow::function_node<shared_ptr<det_strip>, bool> get_fooble(g, tbb::flow::unlimited, [](const shared_ptr<det_strip> ds_p) {
-      bool saw_fooble = ds_p->fooble();
-      if (saw_fooble && ds_p->data_quality() > 0.9) {
-  cout << "Fooble: " << saw_fooble << " at " << ds_p->position() << endl;
+  enum dq_route { good_strips };
+  routing::route_stats<1> dq_routes;
+  routing::predicate_router<strip_result, 1>::node_type dq_router(g, tbb::flow::unlimited,
+    routing::predicate_router<strip_result, 1>(dq_routes, {{
+      [](strip_result& result) { return result.fooble_evaluated; } }}));
+  tbb::flow::function_node<strip_result, bool> get_fooble(g, tbb::flow::unlimited, [](strip_result result) {
+      if (result.fooble) {
+  cout << "Fooble: " << result.fooble << " at " << result.position << endl;
   return true;
       }
       return false;
     });
-  tbb::flow::function_node<bool, bool> count_fooble(g, tbb::flow::unlimited, fooble_counter{counted_foobles}); // N.B. counted_foobles protected by mutex (otherwise, use concurrency=1)
-  tbb::flow::function_node<shared_ptr<det_strip>> dq_hist(g, tbb::flow::unlimited, std::ref(my_dq)); // N.B. DQ filling protected by mutex
+  tbb::flow::function_node<bool, bool> count_fooble(g, tbb::flow::unlimited, fooble_counter{counted_foobles});
+  tbb::flow::function_node<strip_result> fill_dq(g, tbb::flow::unlimited,
+    hist::make_fill_body(my_dq, [](dq_hist& h, strip_result result) {
+      h.fill(result.position, result.data_quality, result.signal);
+    }));
 
   // Test node - don't connect this node in production ;-)
-  tbb::flow::function_node<shared_ptr<det_strip>, shared_ptr<det_strip>> dumper(g, 1, [](const shared_ptr<det_strip> ds_p) {
-      ds_p->dump_strip(std::cout); 
-      return ds_p;
+  tbb::flow::function_node<strip_view, strip_view> dumper(g, 1, [](strip_view sv) {
+      sv.dump_strip(std::cout); 
+      return sv;
     });
 
-  tbb::flow::make_edge(loader, calculate_dq);
-  tbb::flow::make_edge(calculate_dq, get_signal);
-  tbb::flow::make_edge(calculate_dq, get_fooble);
+  tbb::flow::make_edge(loader, analyse_strip);
+  tbb::flow::make_edge(analyse_strip, fill_dq);
+  tbb::flow::make_edge(analyse_strip, dq_router);
+  tbb::flow::make_edge(tbb::flow::output_port<good_strips>(dq_router), get_fooble);
   tbb::flow::make_edge(get_fooble, count_fooble);
-  tbb::flow::make_edge(get_signal, dq_hist);
 
   loader.activate();
   g.wait_for_all();
@@ -175,8 +174,11 @@ int main() {
   cout << "---------" << endl;
   my_dq.write_hist(cout);
   cout << "---------" << endl;
-  cout << "Foobles counted: " << counted_foobles << " from " << total_strips << endl;
-  if (float(counted_foobles) / total_strips > 0.2) {
+  size_t total_foobles = counted_foobles.combine(std::plus<size_t>());
+  cout << "Strips rejected by the DQ cut: " << dq_routes.rejected(good_strips)
+    << ", with the fooble trigger evaluated: " << dq_routes.forwarded(good_strips) << endl;
+  cout << "Foobles counted: " << total_foobles << " from " << total_strips << endl;
+  if (float(total_foobles) / total_strips > 0.2) {
     cout << "WE HAVE FOUND A FOOBLE!" << endl;
   }
   cout << "---------" << endl;
@@ -1,35 +1,130 @@
+// Generate simulated fooble data, as a text strip file
+//
+// Strips are generated in parallel in a TBB pipeline. Each strip has its
+// own random engine, seeded from the run seed and the strip number, so
+// the output only depends on the arguments and not on the number of
+// threads or how the work was scheduled. Batches of strips are formatted
+// with std::to_chars into a buffer owned by the batch, then a serial in
+// order stage writes the buffers out in strip order.
+
 #include <iostream>
-#include <fstream>
+#include <charconv>
+#include <cstdio>
+#include <cstdint>
 #include <random>
+#include <string>
 #include <cmath>
 
+#include "tbb/tbb.h"
+
 #include "stripdet.hpp"
 
+// A batch of consecutive strips, as formatted text
+struct strip_batch {
+  size_t first_strip;
+  size_t n_strips;
+  std::string text;
+};
+
+const size_t strips_per_batch = 64;
+
+// Seed for one strip's random engine (splitmix64 of the run seed and
+// strip number), so neighbouring strips get unrelated sequences
+inline uint64_t strip_seed(uint64_t seed, uint64_t strip) {
+  uint64_t z = seed + (strip + 1) * 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+template <typename T>
+inline void append_number(std::string& out, T value, char sep) {
+  char buffer[32];
+  auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+  out.append(buffer, result.ptr);
+  out.push_back(sep);
+}
+
+// Same layout as det_strip::dump_strip(), but floats are written in
+// their shortest round trip form
+void format_strip(det_strip& strip, std::string& out) {
+  append_number(out, strip.n_cells(), ' ');
+  append_number(out, strip.position(), '\n');
+  for (size_t i=0; i<strip.n_cells(); ++i) {
+    det_cell& cell = strip.cell(i);
+    out.push_back(cell.alive() ? '1' : '0');
+    out.push_back(' ');
+    append_number(out, cell.sensor(), ' ');
+    append_number(out, cell.noise(), '\n');
+  }
+}
+
 int main(int argc, char* argv[]) {
   unsigned int strips = 100;
   unsigned int cells = 200;
+  unsigned long seed = 0;
 
-  if (argc==3) {
+  if (argc==3 || argc==4) {
     strips = std::atoi(argv[1]);
     cells = std::atoi(argv[2]);
-  } 
+  }
+  if (argc==4)
+    seed = std::strtoul(argv[3], nullptr, 10);
 
-  std::default_random_engine generator;
+  std::default_random_engine generator(std::default_random_engine::default_seed + seed);
   std::uniform_real_distribution<float> flat_dist(0.0, 1.0);
 
   // Pick a random place for the fooble
   long fooble_centre = (0.1 + flat_dist(generator) * 0.8) * strips;
 
-  std::ofstream ofs("fooble.txt", std::ofstream::out);
+  FILE* out = std::fopen("fooble.txt", "w");
+  if (!out) {
+    std::cerr << "Failed to open output file fooble.txt" << std::endl;
+    return 1;
+  }
+  std::vector<char> out_buffer(1 << 22);
+  std::setvbuf(out, out_buffer.data(), _IOFBF, out_buffer.size());
 
-  for (size_t i=0; i<strips; ++i) {
-    float my_signal = 20.0 + 100.0 / (1.0 + std::pow(std::abs(long(i) - fooble_centre)/20.0, 2));
-    float my_x = float(i) / strips;
-    det_strip test_strip{cells, my_x};
-    test_strip.fill_random(my_signal);
-    test_strip.dump_strip(ofs);
+  size_t next_strip = 0;
+  bool write_ok = true;
+  tbb::tick_count t0 = tbb::tick_count::now();
+  tbb::parallel_pipeline(4 * tbb::this_task_arena::max_concurrency(),
+    tbb::make_filter<void, strip_batch>(tbb::filter_mode::serial_in_order,
+      [&](tbb::flow_control& fc) {
+        strip_batch batch{next_strip, std::min<size_t>(strips_per_batch, strips - next_strip), {}};
+        if (batch.n_strips == 0)
+          fc.stop();
+        next_strip += batch.n_strips;
+        return batch;
+      })
+    &
+    tbb::make_filter<strip_batch, strip_batch>(tbb::filter_mode::parallel,
+      [&](strip_batch batch) {
+        batch.text.reserve(batch.n_strips * (cells + 1) * 24);
+        for (size_t i=batch.first_strip; i<batch.first_strip+batch.n_strips; ++i) {
+          float my_signal = 20.0 + 100.0 / (1.0 + std::pow(std::abs(long(i) - fooble_centre)/20.0, 2));
+          float my_x = float(i) / strips;
+          det_strip strip{cells, my_x};
+          std::mt19937 engine(strip_seed(seed, i));
+          strip.fill_random(my_signal, engine);
+          format_strip(strip, batch.text);
+        }
+        return batch;
+      })
+    &
+    tbb::make_filter<strip_batch, void>(tbb::filter_mode::serial_in_order,
+      [&](const strip_batch& batch) {
+        if (std::fwrite(batch.text.data(), 1, batch.text.size(), out) != batch.text.size())
+          write_ok = false;
+      })
+    );
+  if (std::fclose(out) || !write_ok) {
+    std::cerr << "Failed writing fooble.txt" << std::endl;
+    return 1;
   }
-  ofs.close();
+  tbb::tick_count t1 = tbb::tick_count::now();
+  std::cout << "Wrote " << strips << " strips of " << cells << " cells in "
+    << (t1-t0).seconds() << "s" << std::endl;
 
   return 0;
 }
@@ -0,0 +1,36 @@
+// Convert a text strip file (as written by det-rand-dump) into the
+// binary strip format, which det-data-proc can map without parsing
+//
+// det-txt2bin [INPUT_TXT] [OUTPUT_BIN]
+
+#include <iostream>
+
+#include "stripdet.hpp"
+#include "stripfile.hpp"
+#include "stripparse.hpp"
+
+int main(int argc, char* argv[]) {
+  const char* in_file = "fooble.txt";
+  const char* out_file = "fooble.bin";
+  if (argc >= 2)
+    in_file = argv[1];
+  if (argc == 3)
+    out_file = argv[2];
+
+  // Text files are parsed in parallel chunks
+  tbb::tick_count t0 = tbb::tick_count::now();
+  strip_set strips;
+  if (!load_strips_parallel(in_file, strips)) {
+    std::cerr << "Failed to load strips from input file " << in_file << std::endl;
+    return 1;
+  }
+  tbb::tick_count t1 = tbb::tick_count::now();
+  if (!write_strip_file(strips, out_file)) {
+    std::cerr << "Failed to write output file " << out_file << std::endl;
+    return 1;
+  }
+  std::cout << "Converted " << strips.size() << " strips from " << in_file
+    << " to " << out_file << " (parsing took " << (t1-t0).seconds() << "s)" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,93 @@
+// Fill the thread local histograms from a graph and from a parallel_for
+// and check that the merged result matches a serial fill exactly
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "tbb/tbb.h"
+#include "tbb/flow_graph.h"
+
+#include "histogram.hpp"
+
+using std::cout;
+using std::endl;
+
+// Compare every bin (including under/overflow) of two 2D histograms
+bool same_contents(const hist::contents<2>& a, const hist::contents<2>& b) {
+  for (size_t i=0; i<a.get_axis(0).bins()+2; ++i) {
+    for (size_t j=0; j<a.get_axis(1).bins()+2; ++j) {
+      if (a.entries({{i, j}}) != b.entries({{i, j}}) ||
+          a.sum_w({{i, j}}) != b.sum_w({{i, j}}))
+        return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  size_t n_values = 1000000;
+  if (argc == 2)
+    n_values = std::atol(argv[1]);
+
+  // Integer weights keep the sums exact, whatever order they are added in
+  std::default_random_engine generator;
+  std::normal_distribution<double> gauss(0.0, 1.0);
+  std::vector<double> xs(n_values), ys(n_values);
+  for (size_t i=0; i<n_values; ++i) {
+    xs[i] = gauss(generator);
+    ys[i] = gauss(generator);
+  }
+  hist::axis x_axis(100, -3.0, 3.0);
+  hist::axis y_axis({-4.0, -2.0, -1.0, -0.5, 0.0, 0.5, 1.0, 2.0, 4.0});
+  auto weight = [](size_t i) { return double(i % 4); };
+
+  hist::histogram<2> serial(x_axis, y_axis);
+  tbb::tick_count t0 = tbb::tick_count::now();
+  for (size_t i=0; i<n_values; ++i)
+    serial.fill(xs[i], ys[i], weight(i));
+  tbb::tick_count t1 = tbb::tick_count::now();
+  cout << "Serial fill: " << (t1-t0).seconds() << "s" << endl;
+
+  hist::histogram<2> parallel(x_axis, y_axis);
+  t0 = tbb::tick_count::now();
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, n_values), [&](const tbb::blocked_range<size_t>& r) {
+    auto& local = parallel.local();
+    for (size_t i=r.begin(); i!=r.end(); ++i)
+      local.fill({{xs[i], ys[i]}}, weight(i));
+  });
+  t1 = tbb::tick_count::now();
+  cout << "parallel_for fill: " << (t1-t0).seconds() << "s" << endl;
+
+  tbb::flow::graph g;
+  size_t next = 0;
+  hist::histogram<2> from_graph(x_axis, y_axis);
+  tbb::flow::input_node<size_t> source(g, [&next, n_values](tbb::flow_control& fc) {
+      if (next >= n_values)
+        fc.stop();
+      return next++;
+    });
+  tbb::flow::function_node<size_t> filler(g, tbb::flow::unlimited,
+    hist::make_fill_body(from_graph, [&](hist::histogram<2>& h, size_t i) {
+      h.fill(xs[i], ys[i], weight(i));
+    }));
+  tbb::flow::make_edge(source, filler);
+  t0 = tbb::tick_count::now();
+  source.activate();
+  g.wait_for_all();
+  t1 = tbb::tick_count::now();
+  cout << "Graph fill: " << (t1-t0).seconds() << "s" << endl;
+
+  auto reference = serial.merged();
+  cout << "Entries: " << reference.total_entries() << ", sum of weights: "
+    << reference.total_sum_w() << endl;
+  if (reference.total_entries() != n_values ||
+      !same_contents(reference, parallel.merged()) ||
+      !same_contents(reference, from_graph.merged())) {
+    cout << "Parallel histograms differ from the serial one" << endl;
+    return 1;
+  }
+  cout << "Parallel histograms match" << endl;
+
+  return 0;
+}
@@ -0,0 +1,250 @@
+// Thread local, mergeable histograms for filling from TBB graph nodes
+//
+// Every thread that fills a histogram gets its own private copy of the
+// bin contents (via tbb::enumerable_thread_specific), so filling never
+// takes a lock and scales with the number of threads. The copies are
+// only combined when the result is asked for, with merged().
+//
+// Histograms can be 1D or 2D, with fixed width or variable bins on each
+// axis, and weighted. Every axis has an underflow bin (index 0) and an
+// overflow bin (index bins()+1); NaN values go to the overflow bin.
+//
+//   hist::histogram<1> h(hist::axis(10, 0.0, 1.0));
+//   tbb::flow::function_node<float> filler(g, tbb::flow::unlimited,
+//     hist::make_fill_body(h, [](hist::histogram<1>& h, float x) { h.fill(x); }));
+//   ...
+//   g.wait_for_all();
+//   auto result = h.merged();
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#include "tbb/enumerable_thread_specific.h"
+#include "tbb/flow_graph.h"
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H 1
+
+namespace hist {
+
+  // Binning along one axis, either n equal bins in [low, high) or
+  // variable bins given by their (increasing) edges
+  class axis {
+  private:
+    size_t m_bins;
+    double m_low;
+    double m_high;
+    std::vector<double> m_edges;
+
+  public:
+    axis(size_t bins, double low, double high):
+      m_bins{bins}, m_low{low}, m_high{high} {};
+
+    axis(const std::vector<double>& edges):
+      m_bins{edges.size() - 1}, m_low{edges.front()}, m_high{edges.back()},
+      m_edges{edges} {};
+
+    // Number of in range bins
+    size_t bins() const {
+      return m_bins;
+    }
+
+    // Bin index of x, 0 is underflow and bins()+1 is overflow
+    size_t index(double x) const {
+      if (x < m_low)
+        return 0;
+      if (!(x < m_high))
+        return m_bins + 1;
+      if (m_edges.empty()) {
+        size_t bin = (x - m_low) / (m_high - m_low) * m_bins;
+        // Guard against rounding up at the top edge
+        return std::min(bin, m_bins - 1) + 1;
+      }
+      return std::upper_bound(m_edges.begin(), m_edges.end(), x) - m_edges.begin();
+    }
+
+    // Edges of bin index i (1 to bins())
+    double lower(size_t i) const {
+      return m_edges.empty() ? m_low + (m_high - m_low) * (i-1) / m_bins : m_edges[i-1];
+    }
+
+    double upper(size_t i) const {
+      return m_edges.empty() ? m_low + (m_high - m_low) * i / m_bins : m_edges[i];
+    }
+  };
+
+
+  // Bin contents, stored flat with the underflow and overflow bins included;
+  // this is both the per thread storage and the merged result
+  template <size_t Dim>
+  class contents {
+  private:
+    std::array<axis, Dim> m_axes;
+    std::vector<size_t> m_entries;
+    std::vector<double> m_sum_w;
+    std::vector<double> m_sum_w2;
+
+  public:
+    contents(const std::array<axis, Dim>& axes):
+      m_axes{axes}
+    {
+      size_t n = 1;
+      for (auto& a: m_axes)
+        n *= a.bins() + 2;
+      m_entries.assign(n, 0);
+      m_sum_w.assign(n, 0.0);
+      m_sum_w2.assign(n, 0.0);
+    };
+
+    const axis& get_axis(size_t d = 0) const {
+      return m_axes[d];
+    }
+
+    // Flat bin number from per axis indexes (row major, the last axis varies fastest)
+    size_t flat(const std::array<size_t, Dim>& index) const {
+      size_t bin = 0;
+      for (size_t d=0; d<Dim; ++d)
+        bin = bin * (m_axes[d].bins() + 2) + index[d];
+      return bin;
+    }
+
+    void add(size_t bin, double w) {
+      ++m_entries[bin];
+      m_sum_w[bin] += w;
+      m_sum_w2[bin] += w*w;
+    }
+
+    void fill(const std::array<double, Dim>& values, double w = 1.0) {
+      std::array<size_t, Dim> index;
+      for (size_t d=0; d<Dim; ++d)
+        index[d] = m_axes[d].index(values[d]);
+      add(flat(index), w);
+    }
+
+    void merge(const contents& other) {
+      for (size_t i=0; i<m_entries.size(); ++i) {
+        m_entries[i] += other.m_entries[i];
+        m_sum_w[i] += other.m_sum_w[i];
+        m_sum_w2[i] += other.m_sum_w2[i];
+      }
+    }
+
+    // Per bin accessors, taking the per axis indexes
+    size_t entries(const std::array<size_t, Dim>& index) const {
+      return m_entries[flat(index)];
+    }
+
+    double sum_w(const std::array<size_t, Dim>& index) const {
+      return m_sum_w[flat(index)];
+    }
+
+    double sum_w2(const std::array<size_t, Dim>& index) const {
+      return m_sum_w2[flat(index)];
+    }
+
+    // Totals, including the underflow and overflow bins
+    size_t total_entries() const {
+      size_t total = 0;
+      for (auto e: m_entries)
+        total += e;
+      return total;
+    }
+
+    double total_sum_w() const {
+      double total = 0.0;
+      for (auto w: m_sum_w)
+        total += w;
+      return total;
+    }
+  };
+
+
+  // Histogram that can be filled concurrently from any number of threads
+  template <size_t Dim>
+  class histogram {
+  private:
+    contents<Dim> m_empty;
+    tbb::enumerable_thread_specific<contents<Dim>> m_local;
+
+  public:
+    histogram(const std::array<axis, Dim>& axes):
+      m_empty{axes}, m_local(m_empty) {};
+
+    template <size_t D = Dim, typename std::enable_if<D == 1, int>::type = 0>
+    histogram(const axis& x):
+      histogram(std::array<axis, 1>{{x}}) {};
+
+    template <size_t D = Dim, typename std::enable_if<D == 2, int>::type = 0>
+    histogram(const axis& x, const axis& y):
+      histogram(std::array<axis, 2>{{x, y}}) {};
+
+    histogram(const histogram&) = delete;
+    histogram& operator=(const histogram&) = delete;
+
+    void fill(const std::array<double, Dim>& values, double w = 1.0) {
+      m_local.local().fill(values, w);
+    }
+
+    template <size_t D = Dim, typename std::enable_if<D == 1, int>::type = 0>
+    void fill(double x, double w = 1.0) {
+      fill(std::array<double, 1>{{x}}, w);
+    }
+
+    template <size_t D = Dim, typename std::enable_if<D == 2, int>::type = 0>
+    void fill(double x, double y, double w = 1.0) {
+      fill(std::array<double, 2>{{x, y}}, w);
+    }
+
+    // The calling thread's contents. Looking this up once and filling it
+    // directly saves the thread lookup on every fill, e.g., once per range
+    // in a parallel_for body.
+    contents<Dim>& local() {
+      return m_local.local();
+    }
+
+    // Combine the per thread contents; must not be called while
+    // other threads are still filling
+    contents<Dim> merged() const {
+      contents<Dim> result{m_empty};
+      for (auto& local: m_local)
+        result.merge(local);
+      return result;
+    }
+
+    // Throw away everything filled so far
+    void reset() {
+      m_local.clear();
+    }
+  };
+
+
+  // Graph node body that calls fill(hist, msg) for every message. The
+  // node copies its body, so this only holds a pointer to the histogram
+  // (or any other object holding histograms) that gets filled.
+  template <typename Hist, typename Fill>
+  class fill_body {
+  private:
+    Hist* m_hist;
+    Fill m_fill;
+
+  public:
+    fill_body(Hist& hist, Fill fill):
+      m_hist{&hist}, m_fill{fill} {};
+
+    template <typename Msg>
+    tbb::flow::continue_msg operator() (const Msg& msg) {
+      m_fill(*m_hist, msg);
+      return tbb::flow::continue_msg{};
+    }
+  };
+
+  template <typename Hist, typename Fill>
+  fill_body<Hist, Fill> make_fill_body(Hist& hist, Fill fill) {
+    return fill_body<Hist, Fill>(hist, fill);
+  }
+
+} // namespace hist
+
+#endif  // HISTOGRAM_H
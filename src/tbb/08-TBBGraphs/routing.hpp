@@ -0,0 +1,128 @@
+// Predicate routing node for TBB graphs
+//
+// A predicate_router is the body of a multifunction_node with N output
+// ports, all carrying the input type. Each port has a predicate, and a
+// message is only put to the ports whose predicate accepts it, so the
+// branches behind a port never see messages they have no use for. With
+// N=1 this is a simple filter node.
+//
+// Predicates take the message by reference and are evaluated in port
+// order on a single copy, so a predicate can cache something in the
+// message (e.g., a strip_view's data quality) for the later predicates.
+// The message is only put to the accepting ports once every predicate
+// has run, so all of them see it as the last predicate left it.
+//
+// The router counts, per port, how many messages were forwarded and how
+// many rejected; the counters are thread local, so routing never locks.
+//
+//   routing::route_stats<2> stats;
+//   routing::predicate_router<int, 2>::node_type router(g, tbb::flow::unlimited,
+//     routing::predicate_router<int, 2>(stats, {{
+//       [](int& i) { return i % 2 == 0; },
+//       [](int& i) { return i > 100; } }}));
+//   tbb::flow::make_edge(tbb::flow::output_port<0>(router), evens);
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <tuple>
+#include <utility>
+
+#include "tbb/enumerable_thread_specific.h"
+#include "tbb/flow_graph.h"
+
+#ifndef ROUTING_H
+#define ROUTING_H 1
+
+namespace routing {
+
+  // Tuple of N copies of T, the output type of an N port router
+  template <typename T, typename Seq>
+  struct repeat_tuple_impl;
+
+  template <typename T, size_t... I>
+  struct repeat_tuple_impl<T, std::index_sequence<I...>> {
+    template <size_t> using same = T;
+    typedef std::tuple<same<I>...> type;
+  };
+
+  template <typename T, size_t N>
+  using repeat_tuple = typename repeat_tuple_impl<T, std::make_index_sequence<N>>::type;
+
+
+  // Per port forwarded and rejected message counts
+  template <size_t N>
+  class route_stats {
+  private:
+    typedef std::array<size_t, N> counts;
+    tbb::enumerable_thread_specific<counts> m_forwarded;
+    tbb::enumerable_thread_specific<counts> m_rejected;
+
+    static size_t total(const tbb::enumerable_thread_specific<counts>& per_thread, size_t port) {
+      size_t sum = 0;
+      for (auto& c: per_thread)
+        sum += c[port];
+      return sum;
+    }
+
+  public:
+    route_stats():
+      m_forwarded(counts{}), m_rejected(counts{}) {};
+
+    void count(size_t port, bool forwarded) {
+      ++(forwarded ? m_forwarded : m_rejected).local()[port];
+    }
+
+    // Totals over all threads; only meaningful once the graph is idle
+    size_t forwarded(size_t port) const {
+      return total(m_forwarded, port);
+    }
+
+    size_t rejected(size_t port) const {
+      return total(m_rejected, port);
+    }
+  };
+
+
+  template <typename T, size_t N>
+  class predicate_router {
+  public:
+    typedef tbb::flow::multifunction_node<T, repeat_tuple<T, N>> node_type;
+    typedef std::function<bool(T&)> predicate;
+
+  private:
+    route_stats<N>* m_stats;
+    std::array<predicate, N> m_predicates;
+
+    template <size_t Port>
+    void put(const T& msg, bool accept, typename node_type::output_ports_type& ports) {
+      m_stats->count(Port, accept);
+      if (accept)
+        std::get<Port>(ports).try_put(msg);
+    }
+
+    template <size_t... Port>
+    void route_all(T& msg, typename node_type::output_ports_type& ports,
+      std::index_sequence<Port...>) {
+      // Evaluate all the predicates in port order, then put
+      std::array<bool, N> accept;
+      for (size_t port=0; port<N; ++port)
+        accept[port] = m_predicates[port](msg);
+      int in_order[] = {(put<Port>(msg, accept[Port], ports), 0)...};
+      (void)in_order;
+    }
+
+  public:
+    // TBB copies the body, so the statistics are held by pointer
+    predicate_router(route_stats<N>& stats, const std::array<predicate, N>& predicates):
+      m_stats{&stats}, m_predicates{predicates} {};
+
+    void operator() (const T& input, typename node_type::output_ports_type& ports) {
+      T msg{input};
+      route_all(msg, ports, std::make_index_sequence<N>());
+    }
+  };
+
+} // namespace routing
+
+#endif  // ROUTING_H
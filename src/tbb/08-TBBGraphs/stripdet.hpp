@@ -2,11 +2,65 @@
 #include <fstream>
 #include <vector>
 #include <cstdlib>
+#include <cstdint>
 #include <cmath>
+#include <random>
+#include <algorithm>
+#include "simdmath.hpp"
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #ifndef STRIP_DET_H
 #define STRIP_DET_H 1
 
+// The time wasting part of the fooble calculation, where each cell's
+// answer is iterated as answer += log(pow(answer + 1.0, 2.5)) 1000 times.
+// This is done for all of a strip's fooble candidate cells at once with
+// the vectorised maths functions, then the answers are summed in cell
+// order to give the fooble trigger. N.B. answers are rounded to float
+// after each iteration, as answer is a float in the cell by cell version.
+inline float fooble_trigger(std::vector<double>& answers) {
+  std::vector<double> tmp(answers.size());
+  for (int i = 0; i < 1000; ++i) {
+    for (size_t c = 0; c < answers.size(); ++c)
+      tmp[c] = answers[c] + 1.0;
+    simdmath::pow(tmp.data(), 2.5, tmp.data(), tmp.size());
+    simdmath::log(tmp.data(), tmp.data(), tmp.size());
+    for (size_t c = 0; c < answers.size(); ++c)
+      answers[c] = float(answers[c] + tmp[c]);
+  }
+  float trigger = 0.0;
+  for (auto answer: answers)
+    trigger += float(answer);
+  return trigger;
+}
+
+
+// Result of the fused strip analysis (see strip_view::analyse()), which
+// gives everything the detector needs from a strip in a single pass
+struct strip_result {
+  float position;
+  float data_quality;
+  float signal;
+  // The fooble trigger is only evaluated for strips that pass the data
+  // quality cut, fooble is false for all other strips
+  bool fooble_evaluated;
+  bool fooble;
+};
+
+
+// Largest number of bad cells a strip of n_cells can have and still pass
+// data quality > dq_cut, using the same float arithmetic as the data
+// quality itself so that the answer is exact
+inline size_t max_bad_cells(size_t n_cells, double dq_cut) {
+  long max_bad = std::max(0L, std::min(long(n_cells), long(n_cells * (1.0 - dq_cut)) + 1));
+  while (max_bad > 0 && !(float(n_cells - max_bad)/n_cells > dq_cut))
+    --max_bad;
+  return max_bad;
+}
+
+
 class det_cell {
 private:
   bool m_alive;
@@ -56,6 +110,22 @@ public:
     }
   }
 
+  // As above, but drawing from the given random engine, so that cells
+  // can be filled reproducibly and from many threads at once
+  template <typename Engine>
+  void fill_random(float signal, Engine& engine) {
+    std::uniform_real_distribution<float> flat(0.0f, 1.0f);
+    if (flat(engine) < 0.03f) {
+      m_alive = false;
+      m_sensor = 0.0f;
+      m_noise = 0.0f;
+    } else {
+      m_alive = true;
+      m_noise = flat(engine) * 10.0f;
+      m_sensor = flat(engine) * signal;
+    }
+  }
+
   void dump_cell(std::ostream& ofs) {
     ofs << m_alive << " " << m_sensor << " " << m_noise;
   }
@@ -97,6 +167,10 @@ public:
     return m_n_cells;
   }
 
+  det_cell& cell(size_t i) {
+    return m_cells[i];
+  }
+
   float position() {
     return m_position;
   }
@@ -136,16 +210,15 @@ public:
   // This is the silly fooble detction calculation
   bool fooble() {
     if (!m_done_dq) return false;
-    float fooble_trigger = 0.0;
+    std::vector<double> answers;
     for (auto& cell : m_cells) {
       if (cell.good_cell() && cell.sensor() > cell.noise() * 3.0) {
         float answer = cell.sensor() - cell.noise();
-        // Time wasting ;-)
-        for (int i = 0; i < 1000; ++i) answer += log(pow(answer + 1.0, 2.5));
-        fooble_trigger += answer;
+        answers.push_back(answer);
       }
     }
-    if (fooble_trigger > 3.0e+6) return true;
+    // Time wasting ;-)
+    if (fooble_trigger(answers) > 3.0e+6) return true;
     return false;
   }
 
@@ -153,6 +226,11 @@ public:
     for (auto& cell : m_cells) cell.fill_random(signal);
   }
 
+  template <typename Engine>
+  void fill_random(float signal, Engine& engine) {
+    for (auto& cell : m_cells) cell.fill_random(signal, engine);
+  }
+
   void dump_strip(std::ostream& ofs) {
     ofs << m_n_cells << " " << m_position << std::endl;
     for (auto& cell: m_cells) {
@@ -178,4 +256,380 @@ public:
 };  
     
 
+// Structure of arrays kernels
+// Cells are processed in blocks of 8, where the alive flags of a block
+// are the bits of a single byte. The good cell test is then done with
+// SIMD compares of noise against sensor, giving a bitmask of the good
+// cells in the block without any per cell branching.
+namespace strip_kernels {
+  const size_t block = 8;
+
+  // Bitmask of the good cells in the block of 8 starting at sensor/noise
+  inline uint8_t good_mask(const float* sensor, const float* noise, uint8_t alive) {
+#if defined(__AVX__)
+    int m = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(noise), _mm256_loadu_ps(sensor), _CMP_NGT_UQ));
+#elif defined(__SSE2__)
+    int m = _mm_movemask_ps(_mm_cmpngt_ps(_mm_loadu_ps(noise), _mm_loadu_ps(sensor))) |
+      (_mm_movemask_ps(_mm_cmpngt_ps(_mm_loadu_ps(noise+4), _mm_loadu_ps(sensor+4))) << 4);
+#else
+    int m = 0;
+    for (size_t i=0; i<block; ++i)
+      m |= int(!(noise[i] > sensor[i])) << i;
+#endif
+    return alive & m;
+  }
+
+  // Count of good cells over n_blocks
+  inline size_t good_cells(const float* sensor, const float* noise, const uint8_t* alive, size_t n_blocks) {
+    size_t good = 0;
+    for (size_t b=0; b<n_blocks; ++b)
+      good += __builtin_popcount(good_mask(sensor+b*block, noise+b*block, alive[b]));
+    return good;
+  }
+
+  // Running sum of squared sensor values, one lane per cell of half a
+  // block where SSE is available
+#if defined(__SSE2__)
+  typedef __m128 sq_accumulator;
+
+  inline sq_accumulator sq_zero() {
+    return _mm_setzero_ps();
+  }
+
+  inline float sq_total(sq_accumulator sq_sum) {
+    float lanes[4];
+    _mm_storeu_ps(lanes, sq_sum);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  }
+
+  // Add the squared sensor values of the good cells of one block to
+  // sq_sum, returning the block's good cell mask
+  inline uint8_t accumulate_block(sq_accumulator& sq_sum, const float* sensor,
+    const float* noise, uint8_t alive) {
+    const __m128i lo_bits = _mm_set_epi32(8, 4, 2, 1);
+    const __m128i hi_bits = _mm_set_epi32(128, 64, 32, 16);
+    __m128i a = _mm_set1_epi32(alive);
+    int mask = 0;
+    for (size_t h=0; h<2; ++h) {
+      __m128i bits = h ? hi_bits : lo_bits;
+      __m128 s = _mm_loadu_ps(sensor + h*4);
+      __m128 n = _mm_loadu_ps(noise + h*4);
+      __m128 live = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(a, bits), bits));
+      __m128 good = _mm_and_ps(live, _mm_cmpngt_ps(n, s));
+      sq_sum = _mm_add_ps(sq_sum, _mm_and_ps(good, _mm_mul_ps(s, s)));
+      mask |= _mm_movemask_ps(good) << (h*4);
+    }
+    return mask;
+  }
+#else
+  typedef float sq_accumulator;
+
+  inline sq_accumulator sq_zero() {
+    return 0.0f;
+  }
+
+  inline float sq_total(sq_accumulator sq_sum) {
+    return sq_sum;
+  }
+
+  inline uint8_t accumulate_block(sq_accumulator& sq_sum, const float* sensor,
+    const float* noise, uint8_t alive) {
+    uint8_t good = good_mask(sensor, noise, alive);
+    for (size_t i=0; i<block; ++i)
+      sq_sum += ((good >> i) & 1) ? sensor[i]*sensor[i] : 0.0f;
+    return good;
+  }
+#endif
+
+  // Sum of the squared sensor value of good cells over n_blocks
+  inline float good_sq_sum(const float* sensor, const float* noise, const uint8_t* alive, size_t n_blocks) {
+    sq_accumulator sq_sum = sq_zero();
+    for (size_t b=0; b<n_blocks; ++b)
+      accumulate_block(sq_sum, sensor+b*block, noise+b*block, alive[b]);
+    return sq_total(sq_sum);
+  }
+}
+
+
+// Lightweight view of one strip held in structure of arrays form,
+// the cell columns are owned elsewhere (e.g., by a strip_set). Offers
+// the same analysis methods as det_strip and is cheap to copy, so it
+// can be passed around a graph by value.
+class strip_view {
+private:
+  const float* m_sensor;
+  const float* m_noise;
+  const uint8_t* m_alive;
+  size_t m_n_cells;
+  float m_position;
+  float m_data_quality;
+  bool m_done_dq;
+
+  size_t n_blocks() const {
+    return (m_n_cells + strip_kernels::block - 1) / strip_kernels::block;
+  }
+
+public:
+  strip_view():
+    strip_view(nullptr, nullptr, nullptr, 0, 0.0f) {};
+
+  strip_view(const float* sensor, const float* noise, const uint8_t* alive,
+    size_t n_cells, float position):
+    m_sensor{sensor}, m_noise{noise}, m_alive{alive},
+    m_n_cells{n_cells}, m_position{position},
+    m_data_quality{-1.0f}, m_done_dq{false}
+  {};
+
+  size_t n_cells() const {
+    return m_n_cells;
+  }
+
+  float position() const {
+    return m_position;
+  }
+
+  bool alive(size_t i) const {
+    return (m_alive[i/strip_kernels::block] >> (i%strip_kernels::block)) & 1;
+  }
+
+  float sensor(size_t i) const {
+    return m_sensor[i];
+  }
+
+  float noise(size_t i) const {
+    return m_noise[i];
+  }
+
+  // As for det_strip, data quality is cached in the view
+  float data_quality() {
+    if (m_done_dq)
+      return m_data_quality;
+    if (m_n_cells == 0)
+      return -1.0f;
+    m_done_dq = true;
+    size_t good_cells = strip_kernels::good_cells(m_sensor, m_noise, m_alive, n_blocks());
+    m_data_quality = float(good_cells)/m_n_cells;
+    return m_data_quality;
+  }
+
+  float signal() const {
+    if (!m_done_dq)
+      return 0.0f;
+    size_t live_cells = strip_kernels::good_cells(m_sensor, m_noise, m_alive, n_blocks());
+    if (!live_cells)
+      return 0.0f;
+    float sq_sum = strip_kernels::good_sq_sum(m_sensor, m_noise, m_alive, n_blocks());
+    return std::sqrt(sq_sum/live_cells);
+  }
+
+  // Fooble detection, only visiting the set bits of the good cell masks
+  bool fooble() const {
+    if (!m_done_dq) return false;
+    std::vector<double> answers;
+    for (size_t b=0; b<n_blocks(); ++b) {
+      const size_t base = b*strip_kernels::block;
+      unsigned good = strip_kernels::good_mask(m_sensor+base, m_noise+base, m_alive[b]);
+      while (good) {
+        size_t i = base + __builtin_ctz(good);
+        good &= good - 1;
+        if (m_sensor[i] > m_noise[i] * 3.0) {
+          float answer = m_sensor[i] - m_noise[i];
+          answers.push_back(answer);
+        }
+      }
+    }
+    if (fooble_trigger(answers) > 3.0e+6) return true;
+    return false;
+  }
+
+  // Fused analysis, giving the same results as data_quality(), signal()
+  // and fooble() in a single pass over the blocks; each block's good cell
+  // mask is computed only once. The (expensive) fooble trigger is only
+  // run if the data quality is above dq_cut, and fooble candidates stop
+  // being collected as soon as there are too many bad cells for that. If
+  // with_fooble is false only the data quality and signal are measured.
+  strip_result analyse(double dq_cut = 0.9, bool with_fooble = true) const {
+    strip_result result{m_position, -1.0f, 0.0f, false, false};
+    if (m_n_cells == 0)
+      return result;
+    size_t good_cells = 0;
+    size_t max_bad = max_bad_cells(m_n_cells, dq_cut);
+    bool candidates = with_fooble && float(m_n_cells)/m_n_cells > dq_cut;
+    strip_kernels::sq_accumulator sq_sum = strip_kernels::sq_zero();
+    std::vector<double> answers;
+    for (size_t b=0; b<n_blocks(); ++b) {
+      const size_t base = b*strip_kernels::block;
+      unsigned good = strip_kernels::accumulate_block(sq_sum, m_sensor+base, m_noise+base, m_alive[b]);
+      good_cells += __builtin_popcount(good);
+      if (!candidates)
+        continue;
+      if (std::min(base+strip_kernels::block, m_n_cells) - good_cells > max_bad) {
+        candidates = false;
+        continue;
+      }
+      while (good) {
+        size_t i = base + __builtin_ctz(good);
+        good &= good - 1;
+        if (m_sensor[i] > m_noise[i] * 3.0) {
+          float answer = m_sensor[i] - m_noise[i];
+          answers.push_back(answer);
+        }
+      }
+    }
+    result.data_quality = float(good_cells)/m_n_cells;
+    if (good_cells)
+      result.signal = std::sqrt(strip_kernels::sq_total(sq_sum)/good_cells);
+    if (candidates) {
+      result.fooble_evaluated = true;
+      result.fooble = fooble_trigger(answers) > 3.0e+6;
+    }
+    return result;
+  }
+
+  void dump_strip(std::ostream& ofs) const {
+    ofs << m_n_cells << " " << m_position << "\n";
+    for (size_t i=0; i<m_n_cells; ++i)
+      ofs << alive(i) << " " << m_sensor[i] << " " << m_noise[i] << "\n";
+  }
+};
+
+
+// All of the strips of a file held contiguously in CSR style: one set
+// of cell columns for every strip, plus an offset table giving where each
+// strip starts. Strips are padded to whole blocks of 8 cells with dead
+// cells, so that the SIMD kernels never straddle two strips.
+class strip_set {
+private:
+  std::vector<size_t> m_offsets;
+  std::vector<size_t> m_n_cells;
+  std::vector<float> m_position;
+  std::vector<float> m_sensor;
+  std::vector<float> m_noise;
+  std::vector<uint8_t> m_alive;
+
+public:
+  strip_set():
+    m_offsets{0} {};
+
+  size_t size() const {
+    return m_n_cells.size();
+  }
+
+  // Raw column access, e.g., for serialisation
+  const std::vector<size_t>& offsets() const { return m_offsets; }
+  const std::vector<size_t>& n_cells() const { return m_n_cells; }
+  const std::vector<float>& positions() const { return m_position; }
+  const std::vector<float>& sensors() const { return m_sensor; }
+  const std::vector<float>& noises() const { return m_noise; }
+  const std::vector<uint8_t>& alives() const { return m_alive; }
+
+  strip_view operator[](size_t i) const {
+    size_t offset = m_offsets[i];
+    return strip_view(m_sensor.data()+offset, m_noise.data()+offset,
+      m_alive.data()+offset/strip_kernels::block, m_n_cells[i], m_position[i]);
+  }
+
+  // Add a strip with all cells dead, returning the offset of its first cell
+  size_t add_strip(size_t n_cells, float position) {
+    size_t padded = (n_cells + strip_kernels::block - 1) / strip_kernels::block * strip_kernels::block;
+    size_t offset = m_offsets.back();
+    m_sensor.resize(offset + padded, 0.0f);
+    m_noise.resize(offset + padded, 0.0f);
+    m_alive.resize((offset + padded) / strip_kernels::block, 0);
+    m_n_cells.push_back(n_cells);
+    m_position.push_back(position);
+    m_offsets.push_back(offset + padded);
+    return offset;
+  }
+
+  // Set cell i, counting from the start of the whole set
+  void set_cell(size_t i, bool alive, float sensor, float noise) {
+    m_sensor[i] = sensor;
+    m_noise[i] = noise;
+    uint8_t bit = uint8_t(1) << (i%strip_kernels::block);
+    if (alive)
+      m_alive[i/strip_kernels::block] |= bit;
+    else
+      m_alive[i/strip_kernels::block] &= ~bit;
+  }
+
+  // Remove the last strip
+  void pop_back() {
+    m_offsets.pop_back();
+    m_n_cells.pop_back();
+    m_position.pop_back();
+    m_sensor.resize(m_offsets.back());
+    m_noise.resize(m_offsets.back());
+    m_alive.resize(m_offsets.back() / strip_kernels::block);
+  }
+
+  void append(det_strip& ds) {
+    size_t offset = add_strip(ds.n_cells(), ds.position());
+    for (size_t i=0; i<ds.n_cells(); ++i) {
+      det_cell& cell = ds.cell(i);
+      set_cell(offset+i, cell.alive(), cell.sensor(), cell.noise());
+    }
+  }
+
+  // Append all of the strips of another set
+  void append(const strip_set& other) {
+    size_t offset = m_offsets.back();
+    m_offsets.reserve(m_offsets.size() + other.size());
+    for (size_t i=1; i<other.m_offsets.size(); ++i)
+      m_offsets.push_back(offset + other.m_offsets[i]);
+    m_n_cells.insert(m_n_cells.end(), other.m_n_cells.begin(), other.m_n_cells.end());
+    m_position.insert(m_position.end(), other.m_position.begin(), other.m_position.end());
+    m_sensor.insert(m_sensor.end(), other.m_sensor.begin(), other.m_sensor.end());
+    m_noise.insert(m_noise.end(), other.m_noise.begin(), other.m_noise.end());
+    m_alive.insert(m_alive.end(), other.m_alive.begin(), other.m_alive.end());
+  }
+
+  // Make room at the end for n_strips more strips with n_cells more cells
+  // (counting each strip's padding), to be filled in by place(); the set
+  // can't be used until all of the new strips have been placed
+  void grow(size_t n_strips, size_t n_cells) {
+    m_offsets.resize(m_offsets.size() + n_strips);
+    m_n_cells.resize(m_n_cells.size() + n_strips);
+    m_position.resize(m_position.size() + n_strips);
+    m_sensor.resize(m_sensor.size() + n_cells);
+    m_noise.resize(m_noise.size() + n_cells);
+    m_alive.resize(m_alive.size() + n_cells/strip_kernels::block);
+  }
+
+  // Copy the strips of other in as strips first_strip onwards, with their
+  // cells from first_cell; copies into different parts of the space made
+  // by grow() can run concurrently
+  void place(const strip_set& other, size_t first_strip, size_t first_cell) {
+    for (size_t i=0; i<other.size(); ++i)
+      m_offsets[first_strip+i+1] = first_cell + other.m_offsets[i+1];
+    std::copy(other.m_n_cells.begin(), other.m_n_cells.end(), m_n_cells.begin() + first_strip);
+    std::copy(other.m_position.begin(), other.m_position.end(), m_position.begin() + first_strip);
+    std::copy(other.m_sensor.begin(), other.m_sensor.end(), m_sensor.begin() + first_cell);
+    std::copy(other.m_noise.begin(), other.m_noise.end(), m_noise.begin() + first_cell);
+    std::copy(other.m_alive.begin(), other.m_alive.end(),
+      m_alive.begin() + first_cell/strip_kernels::block);
+  }
+
+  void reserve(size_t n_strips, size_t n_cells) {
+    m_offsets.reserve(n_strips+1);
+    m_n_cells.reserve(n_strips);
+    m_position.reserve(n_strips);
+    m_sensor.reserve(n_cells);
+    m_noise.reserve(n_cells);
+    m_alive.reserve(n_cells/strip_kernels::block);
+  }
+
+  // Load every strip in a text strip file (as written by dump_strip)
+  size_t load_strips(std::istream& ifs) {
+    det_strip ds{};
+    size_t loaded = 0;
+    while (ds.load_strip(ifs)) {
+      append(ds);
+      ++loaded;
+    }
+    return loaded;
+  }
+};
+
+
 #endif  // STRIP_DET_H
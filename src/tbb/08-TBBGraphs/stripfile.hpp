@@ -0,0 +1,196 @@
+// Binary strip file format, which stores a strip_set as it is laid out
+// in memory so that it can be mapped and used without any parsing
+//
+// Layout (native endian, every section starts on a 64 byte boundary):
+//   header     - magic, version, strip count, total (padded) cell count
+//                and the byte offset of each of the sections below
+//   offsets    - uint64 cell offset of each strip, plus one end entry
+//   n_cells    - uint64 number of (unpadded) cells in each strip
+//   positions  - float position of each strip
+//   sensor     - float sensor column for all cells
+//   noise      - float noise column for all cells
+//   alive      - alive bitmask, one byte per block of 8 cells
+
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stripdet.hpp"
+
+#ifndef STRIP_FILE_H
+#define STRIP_FILE_H 1
+
+const char strip_file_magic[4] = {'F', 'S', 'T', 'R'};
+const uint32_t strip_file_version = 1;
+
+struct strip_file_header {
+  char magic[4];
+  uint32_t version;
+  uint64_t n_strips;
+  uint64_t n_cells;
+  uint64_t offsets_offset;
+  uint64_t n_cells_offset;
+  uint64_t positions_offset;
+  uint64_t sensor_offset;
+  uint64_t noise_offset;
+  uint64_t alive_offset;
+  uint64_t file_size;
+};
+
+inline uint64_t strip_file_align(uint64_t offset) {
+  return (offset + 63) & ~uint64_t(63);
+}
+
+// Write a strip set in binary format, returns false on failure
+inline bool write_strip_file(const strip_set& strips, const char fname[]) {
+  strip_file_header header;
+  std::memcpy(header.magic, strip_file_magic, sizeof(header.magic));
+  header.version = strip_file_version;
+  header.n_strips = strips.size();
+  header.n_cells = strips.sensors().size();
+  header.offsets_offset = strip_file_align(sizeof(header));
+  header.n_cells_offset = strip_file_align(header.offsets_offset + sizeof(uint64_t)*(header.n_strips+1));
+  header.positions_offset = strip_file_align(header.n_cells_offset + sizeof(uint64_t)*header.n_strips);
+  header.sensor_offset = strip_file_align(header.positions_offset + sizeof(float)*header.n_strips);
+  header.noise_offset = strip_file_align(header.sensor_offset + sizeof(float)*header.n_cells);
+  header.alive_offset = strip_file_align(header.noise_offset + sizeof(float)*header.n_cells);
+  header.file_size = header.alive_offset + header.n_cells/strip_kernels::block;
+
+  std::vector<uint64_t> offsets(strips.offsets().begin(), strips.offsets().end());
+  std::vector<uint64_t> n_cells(strips.n_cells().begin(), strips.n_cells().end());
+
+  std::ofstream ofs(fname, std::ios::out | std::ios::binary);
+  auto write_at = [&ofs](uint64_t offset, const void* data, size_t bytes) {
+    static const char pad[64] = {0};
+    ofs.write(pad, offset - ofs.tellp());
+    ofs.write(static_cast<const char*>(data), bytes);
+  };
+  write_at(0, &header, sizeof(header));
+  write_at(header.offsets_offset, offsets.data(), sizeof(uint64_t)*offsets.size());
+  write_at(header.n_cells_offset, n_cells.data(), sizeof(uint64_t)*n_cells.size());
+  write_at(header.positions_offset, strips.positions().data(), sizeof(float)*header.n_strips);
+  write_at(header.sensor_offset, strips.sensors().data(), sizeof(float)*header.n_cells);
+  write_at(header.noise_offset, strips.noises().data(), sizeof(float)*header.n_cells);
+  write_at(header.alive_offset, strips.alives().data(), header.n_cells/strip_kernels::block);
+  return ofs.good();
+}
+
+
+// Read only, memory mapped binary strip file. Offers the same size() and
+// operator[] interface as strip_set, with the views pointing directly into
+// the mapped file, so no strip is ever parsed or copied.
+class strip_file {
+private:
+  void* m_map;
+  size_t m_map_size;
+  const strip_file_header* m_header;
+
+  template <typename T>
+  const T* section(uint64_t offset) const {
+    return reinterpret_cast<const T*>(static_cast<const char*>(m_map) + offset);
+  }
+
+  // True if a section of count T starting at offset is aligned and lies
+  // inside the mapped file
+  template <typename T>
+  bool section_fits(uint64_t offset, uint64_t count) const {
+    return offset % 64 == 0 && offset <= m_map_size &&
+      count <= (m_map_size - offset) / sizeof(T);
+  }
+
+  // Check the header's sections against the file size, and that every
+  // strip's blocks lie inside the cell columns, before anything is read
+  // through them
+  bool valid() const {
+    const strip_file_header& h = *m_header;
+    if (std::memcmp(h.magic, strip_file_magic, sizeof(h.magic)) ||
+        h.version != strip_file_version ||
+        h.file_size != m_map_size ||
+        h.n_cells % strip_kernels::block ||
+        h.n_strips >= m_map_size ||
+        !section_fits<uint64_t>(h.offsets_offset, h.n_strips+1) ||
+        !section_fits<uint64_t>(h.n_cells_offset, h.n_strips) ||
+        !section_fits<float>(h.positions_offset, h.n_strips) ||
+        !section_fits<float>(h.sensor_offset, h.n_cells) ||
+        !section_fits<float>(h.noise_offset, h.n_cells) ||
+        !section_fits<uint8_t>(h.alive_offset, h.n_cells/strip_kernels::block))
+      return false;
+    const uint64_t* offsets = section<uint64_t>(h.offsets_offset);
+    const uint64_t* n_cells = section<uint64_t>(h.n_cells_offset);
+    if (offsets[h.n_strips] != h.n_cells)
+      return false;
+    for (uint64_t i=0; i<h.n_strips; ++i) {
+      uint64_t blocks = n_cells[i] / strip_kernels::block + (n_cells[i] % strip_kernels::block != 0);
+      if (offsets[i] % strip_kernels::block || offsets[i] > offsets[i+1] ||
+          blocks > (offsets[i+1] - offsets[i]) / strip_kernels::block)
+        return false;
+    }
+    return true;
+  }
+
+public:
+  strip_file():
+    m_map{nullptr}, m_map_size{0}, m_header{nullptr} {};
+
+  ~strip_file() {
+    close();
+  }
+
+  strip_file(const strip_file&) = delete;
+  strip_file& operator=(const strip_file&) = delete;
+
+  // Map the file, returns false if it can't be opened or is not a valid
+  // binary strip file
+  bool open(const char fname[]) {
+    close();
+    int fd = ::open(fname, O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd, &st) || size_t(st.st_size) < sizeof(strip_file_header)) {
+      ::close(fd);
+      return false;
+    }
+    m_map_size = st.st_size;
+    m_map = mmap(nullptr, m_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (m_map == MAP_FAILED) {
+      m_map = nullptr;
+      return false;
+    }
+    m_header = section<strip_file_header>(0);
+    if (!valid()) {
+      close();
+      return false;
+    }
+    madvise(m_map, m_map_size, MADV_SEQUENTIAL);
+    return true;
+  }
+
+  void close() {
+    if (m_map)
+      munmap(m_map, m_map_size);
+    m_map = nullptr;
+    m_map_size = 0;
+    m_header = nullptr;
+  }
+
+  size_t size() const {
+    return m_header ? m_header->n_strips : 0;
+  }
+
+  strip_view operator[](size_t i) const {
+    size_t offset = section<uint64_t>(m_header->offsets_offset)[i];
+    return strip_view(section<float>(m_header->sensor_offset)+offset,
+      section<float>(m_header->noise_offset)+offset,
+      section<uint8_t>(m_header->alive_offset)+offset/strip_kernels::block,
+      section<uint64_t>(m_header->n_cells_offset)[i],
+      section<float>(m_header->positions_offset)[i]);
+  }
+};
+
+#endif  // STRIP_FILE_H
@@ -0,0 +1,171 @@
+// Parallel parser for text strip files (as written by det_strip::dump_strip)
+//
+// The file is mapped into memory and split into byte range chunks. Each
+// chunk resynchronises to the first strip header line that starts inside
+// it (a header has two fields, a cell line always has three) and then
+// parses every strip whose header starts in the chunk, even if the strip's
+// cells run past the chunk end. Numbers are read with std::from_chars and
+// the per chunk results are stitched back together in file order: an
+// exclusive prefix sum of the chunks' strip and cell counts gives each
+// chunk its place in the output, which is sized once, and then every
+// chunk is copied to its place in parallel (as compact.hpp does).
+
+#include <charconv>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tbb/tbb.h"
+
+#include "stripdet.hpp"
+
+#ifndef STRIP_PARSE_H
+#define STRIP_PARSE_H 1
+
+namespace strip_parse {
+
+  inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+  }
+
+  // Skip blanks and newlines
+  inline const char* skip_space(const char* p, const char* end) {
+    while (p != end && (is_space(*p) || *p == '\n'))
+      ++p;
+    return p;
+  }
+
+  // Number of fields on the line starting at p
+  inline int line_fields(const char* p, const char* end) {
+    int fields = 0;
+    while (p != end && *p != '\n') {
+      while (p != end && is_space(*p))
+        ++p;
+      if (p == end || *p == '\n')
+        break;
+      ++fields;
+      while (p != end && !is_space(*p) && *p != '\n')
+        ++p;
+    }
+    return fields;
+  }
+
+  template <typename T>
+  inline const char* parse(const char* p, const char* end, T& value) {
+    p = skip_space(p, end);
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc())
+      return nullptr;
+    return result.ptr;
+  }
+
+  // Result of parsing one chunk; ok is false if parsing stopped on bad
+  // or truncated input, in which case only the strips before it are kept
+  struct chunk_result {
+    strip_set strips;
+    bool ok = true;
+  };
+
+  // Parse all strips whose header line starts in [begin, end), where
+  // file_end bounds the cells of the last strip
+  inline void parse_chunk(const char* file_begin, const char* begin, const char* end,
+    const char* file_end, chunk_result& result) {
+    const char* p = begin;
+    // Move to a line start, then to the first header line
+    if (p != file_begin && *(p-1) != '\n') {
+      while (p != end && *p != '\n')
+        ++p;
+      if (p != end)
+        ++p;
+    }
+    while (p < end && line_fields(p, file_end) != 2) {
+      while (p != end && *p != '\n')
+        ++p;
+      if (p != end)
+        ++p;
+    }
+
+    while (true) {
+      p = skip_space(p, file_end);
+      if (p >= end)
+        return;
+      size_t n_cells;
+      float position;
+      if (!(p = parse(p, file_end, n_cells)) || !(p = parse(p, file_end, position))) {
+        result.ok = false;
+        return;
+      }
+      size_t offset = result.strips.add_strip(n_cells, position);
+      for (size_t i=0; i<n_cells; ++i) {
+        int alive;
+        float sensor, noise;
+        if (!(p = parse(p, file_end, alive)) || !(p = parse(p, file_end, sensor)) ||
+            !(p = parse(p, file_end, noise))) {
+          result.ok = false;
+          // Drop the incomplete strip
+          result.strips.pop_back();
+          return;
+        }
+        result.strips.set_cell(offset+i, alive, sensor, noise);
+      }
+    }
+  }
+
+  // Parse a text buffer in parallel chunks of roughly chunk_size bytes,
+  // appending the strips to strips in file order
+  inline size_t parse_strips(const char* data, size_t size, strip_set& strips,
+    size_t chunk_size = 1 << 20) {
+    size_t n_chunks = size / chunk_size + 1;
+    std::vector<chunk_result> results(n_chunks);
+    tbb::parallel_for(size_t(0), n_chunks, [&](size_t c) {
+      const char* begin = data + std::min(size, c*chunk_size);
+      const char* end = data + std::min(size, (c+1)*chunk_size);
+      parse_chunk(data, begin, end, data+size, results[c]);
+    });
+
+    // Stitch back together, stopping at the first chunk with bad input
+    // just like the serial loader does. There are only a few chunks per
+    // MB, so the prefix sum is done serially.
+    std::vector<size_t> first_strip(n_chunks), first_cell(n_chunks);
+    size_t n_strips = 0, n_cells = 0, used_chunks = 0;
+    for (auto& result: results) {
+      first_strip[used_chunks] = strips.size() + n_strips;
+      first_cell[used_chunks] = strips.sensors().size() + n_cells;
+      n_strips += result.strips.size();
+      n_cells += result.strips.sensors().size();
+      ++used_chunks;
+      if (!result.ok)
+        break;
+    }
+    strips.grow(n_strips, n_cells);
+    tbb::parallel_for(size_t(0), used_chunks, [&](size_t c) {
+      strips.place(results[c].strips, first_strip[c], first_cell[c]);
+    });
+    return n_strips;
+  }
+
+} // namespace strip_parse
+
+// Load a whole text strip file with the parallel parser, returns the
+// number of strips loaded
+inline size_t load_strips_parallel(const char fname[], strip_set& strips) {
+  int fd = ::open(fname, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size == 0) {
+    ::close(fd);
+    return 0;
+  }
+  void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED)
+    return 0;
+  size_t loaded = strip_parse::parse_strips(static_cast<const char*>(map), st.st_size, strips);
+  munmap(map, st.st_size);
+  return loaded;
+}
+
+#endif  // STRIP_PARSE_H
@@ -6,6 +6,7 @@
 #include <cmath>
 
 #include "fdet.hpp"
+#include "simdmath.hpp"
 
 namespace fdet {
 
@@ -96,12 +97,21 @@ namespace fdet {
 
 
     double calc(unsigned long iterations = 10'000'000lu) {
-        // Extra calculations simulating more significant workload
+        // Extra calculations simulating more significant workload,
+        // done a chunk at a time with the vectorised maths functions
         volatile double sum{0.0};
-        double f;
-        for (auto i = 0lu; i < iterations; ++i) {
-            f = (double)(i+1) / iterations * 1.414;
-            sum += std::sin(std::log(f));
+        const unsigned long chunk = 256;
+        double f[chunk];
+        for (auto i = 0lu; i < iterations; i += chunk) {
+            auto n = std::min(chunk, iterations - i);
+            for (auto j = 0lu; j < n; ++j)
+                f[j] = (double)(i+j+1) / iterations * 1.414;
+            simdmath::log(f, f, n);
+            simdmath::sin(f, f, n);
+            double chunk_sum{0.0};
+            for (auto j = 0lu; j < n; ++j)
+                chunk_sum += f[j];
+            sum += chunk_sum;
         }
         return std::abs(std::log(std::abs(sum)));
     }
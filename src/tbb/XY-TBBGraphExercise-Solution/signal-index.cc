@@ -0,0 +1,153 @@
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "signal-index.hpp"
+
+namespace fdet {
+
+    // Varint helpers, 7 bits per byte with the high bit set on
+    // every byte except the last one
+    static void put_varint(std::vector<uint8_t>& out, uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back(uint8_t(v) | 0x80);
+            v >>= 7;
+        }
+        out.push_back(uint8_t(v));
+    }
+
+    static const uint8_t* get_varint(const uint8_t* p, const uint8_t* end, uint64_t& v) {
+        v = 0;
+        for (unsigned shift = 0; p != end && shift < 64; shift += 7) {
+            uint8_t b = *p++;
+            v |= uint64_t(b & 0x7f) << shift;
+            if (!(b & 0x80)) return p;
+        }
+        return nullptr;
+    }
+
+
+    int write_signal_index(const char fname[], size_t detsize, size_t n_frames,
+        const std::vector<std::vector<size_t>>& cell_signals) {
+        if (detsize == 0 || cell_signals.size() / detsize != detsize ||
+            cell_signals.size() % detsize) return 3;
+        std::vector<uint64_t> offsets;
+        std::vector<uint8_t> payload;
+        offsets.reserve(cell_signals.size() + 1);
+        for (auto& cell: cell_signals) {
+            offsets.push_back(payload.size());
+            size_t last = 0;
+            for (auto t: cell) {
+                put_varint(payload, t - last);
+                last = t;
+            }
+        }
+        offsets.push_back(payload.size());
+
+        signal_index_header header;
+        std::memcpy(header.magic, signal_index_magic, sizeof(header.magic));
+        header.version = signal_index_version;
+        header.detsize = detsize;
+        header.n_frames = n_frames;
+        header.payload_size = payload.size();
+
+        std::ofstream out_fp(fname, std::ios::out | std::ios::binary);
+        if (!out_fp.good()) return 1;
+        out_fp.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out_fp.write(reinterpret_cast<const char*>(offsets.data()), sizeof(uint64_t)*offsets.size());
+        out_fp.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+        if (!out_fp.good()) return 2;
+        return 0;
+    }
+
+
+    signal_index::signal_index():
+        m_map{nullptr}, m_map_size{0}, m_header{nullptr},
+        m_offsets{nullptr}, m_payload{nullptr} {}
+
+    signal_index::~signal_index() {
+        close();
+    }
+
+    int signal_index::open(const char fname[]) {
+        close();
+        int fd = ::open(fname, O_RDONLY);
+        if (fd < 0) return 1;
+        struct stat st;
+        if (fstat(fd, &st) || size_t(st.st_size) < sizeof(signal_index_header)) {
+            ::close(fd);
+            return 2;
+        }
+        m_map_size = st.st_size;
+        m_map = mmap(nullptr, m_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (m_map == MAP_FAILED) {
+            m_map = nullptr;
+            return 3;
+        }
+
+        auto base = static_cast<const uint8_t*>(m_map);
+        m_header = reinterpret_cast<const signal_index_header*>(base);
+        // The offset table and payload have to fit in the file, which also
+        // keeps detsize*detsize and the sizes below from overflowing
+        size_t max_offsets = (m_map_size - sizeof(signal_index_header)) / sizeof(uint64_t);
+        if (m_header->detsize == 0 || m_header->detsize > max_offsets / m_header->detsize ||
+            m_header->payload_size > m_map_size) {
+            close();
+            return 4;
+        }
+        size_t n_offsets = m_header->detsize * m_header->detsize + 1;
+        size_t expected = sizeof(signal_index_header) + sizeof(uint64_t)*n_offsets
+            + m_header->payload_size;
+        if (std::memcmp(m_header->magic, signal_index_magic, sizeof(m_header->magic)) ||
+            m_header->version != signal_index_version || expected != m_map_size) {
+            close();
+            return 4;
+        }
+        m_offsets = reinterpret_cast<const uint64_t*>(base + sizeof(signal_index_header));
+        m_payload = reinterpret_cast<const uint8_t*>(m_offsets + n_offsets);
+        // Each cell's bytes must lie inside the payload, which holds if
+        // the offsets never decrease and the last is the payload size
+        if (m_offsets[n_offsets-1] != m_header->payload_size) {
+            close();
+            return 4;
+        }
+        for (size_t i=0; i+1<n_offsets; ++i) {
+            if (m_offsets[i] > m_offsets[i+1]) {
+                close();
+                return 4;
+            }
+        }
+        return 0;
+    }
+
+    void signal_index::close() {
+        if (m_map) munmap(m_map, m_map_size);
+        m_map = nullptr;
+        m_map_size = 0;
+        m_header = nullptr;
+        m_offsets = nullptr;
+        m_payload = nullptr;
+    }
+
+    std::vector<size_t> signal_index::cell_signal(size_t x, size_t y) const {
+        std::vector<size_t> frames;
+        if (!m_header || x >= m_header->detsize || y >= m_header->detsize) return frames;
+        size_t cell = x * m_header->detsize + y;
+        const uint8_t* p = m_payload + m_offsets[cell];
+        const uint8_t* end = m_payload + m_offsets[cell+1];
+        uint64_t t = 0, delta;
+        while (p && p != end) {
+            p = get_varint(p, end, delta);
+            if (p) {
+                t += delta;
+                frames.push_back(t);
+            }
+        }
+        return frames;
+    }
+
+} // namespace fdet
@@ -0,0 +1,68 @@
+// Header file for the fooble detector signal index
+//
+// The signal index is a compact file that persists, for every detector
+// cell, the list of frames in which the signal search fired. Once written
+// the fooble detection step can be re-run from the index alone, without
+// reprocessing any of the raw frames.
+//
+// File layout (all integers little endian, as written by the host):
+//   header        - magic, version, detsize, frame count, payload size
+//   offset table  - (detsize*detsize + 1) uint64 byte offsets into the payload
+//   payload       - per cell, frame numbers delta encoded as LEB128 varints
+//                   (the first value is the frame number itself)
+
+#include <cstdint>
+#include <vector>
+
+#ifndef FDET_SIGNAL_INDEX_H
+#define FDET_SIGNAL_INDEX_H 1
+
+namespace fdet {
+
+    const static char signal_index_magic[4] = {'F', 'D', 'S', 'I'};
+    const static uint32_t signal_index_version = 1;
+
+    struct signal_index_header {
+        char magic[4];
+        uint32_t version;
+        uint64_t detsize;
+        uint64_t n_frames;
+        uint64_t payload_size;
+    };
+
+    // Write the index file; cell_signals holds one time ordered vector of
+    // frame numbers per cell, in x*detsize+y order, so there must be
+    // detsize*detsize of them. Returns 0 on success.
+    int write_signal_index(const char fname[], size_t detsize, size_t n_frames,
+        const std::vector<std::vector<size_t>>& cell_signals);
+
+    // Read only view of an index file, which is mapped into memory
+    // so that opening is cheap and cells are decoded on demand
+    class signal_index {
+    private:
+        void* m_map;
+        size_t m_map_size;
+        const signal_index_header* m_header;
+        const uint64_t* m_offsets;
+        const uint8_t* m_payload;
+
+    public:
+        signal_index();
+        ~signal_index();
+        signal_index(const signal_index&) = delete;
+        signal_index& operator=(const signal_index&) = delete;
+
+        // Map the index file, returns 0 on success
+        int open(const char fname[]);
+        void close();
+
+        size_t detsize() const { return m_header ? m_header->detsize : 0; }
+        size_t n_frames() const { return m_header ? m_header->n_frames : 0; }
+
+        // Decode the time ordered signal frames for cell (x,y)
+        std::vector<size_t> cell_signal(size_t x, size_t y) const;
+    };
+
+} // namespace fdet
+
+#endif // FDET_SIGNAL_INDEX_H
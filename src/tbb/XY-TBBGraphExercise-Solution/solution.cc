@@ -6,12 +6,19 @@
 // discussion and for the reader to implent
 
 #include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <vector>
 #include <array>
+#include <string>
+#include <sstream>
 #include <tbb/tbb.h>
 
 #include "fdet.hpp"
+#include "signal-index.hpp"
 
 #define DEBUG 1
 
@@ -47,17 +54,19 @@ public:
   frame_loader(std::ifstream &ifs_p):
     m_frame_counter{0}, m_input_stream_p(ifs_p) {};
 
-  bool operator() (fdet::f_det& fdet) {
+  fdet::f_det operator() (tbb::flow_control& fc) {
+    fdet::f_det fdet;
     int read_err;
     read_err = fdet.read(m_input_stream_p);
     if (read_err) {
-        return false;
+        fc.stop();
+        return fdet;
     }
     if (DEBUG) {
         std::cout << "frame_loader loaded " << m_frame_counter << std::endl;
     }
     ++m_frame_counter;
-    return true;
+    return fdet;
   }
 
   size_t frame_counter() {
@@ -141,14 +150,21 @@ public:
 
 
 // Signal search
+// The cluster sum for each cell is calculated once and then compared
+// against every threshold, so a sweep over many thresholds costs little
+// more than a single one. Thresholds must be sorted in ascending order,
+// as then the thresholds a cluster passes are always a prefix of the list
+// and there is one det_signal per threshold.
 class signal_search {
 private:
     f_det_vec& m_fdet_data;
-    det_signal& m_fdet_signal;
+    const std::vector<float>& m_thresholds;
+    std::vector<det_signal>& m_fdet_signals;
 
 public:
-    signal_search(f_det_vec& fdet_data, det_signal& fdet_signal):
-        m_fdet_data{fdet_data}, m_fdet_signal{fdet_signal} {};
+    signal_search(f_det_vec& fdet_data, const std::vector<float>& thresholds,
+        std::vector<det_signal>& fdet_signals):
+        m_fdet_data{fdet_data}, m_thresholds{thresholds}, m_fdet_signals{fdet_signals} {};
 
     size_t operator()(size_t t) {
         if (DEBUG) {
@@ -169,12 +185,13 @@ public:
                             }
                         }
                     }
-                    if (sum > fdet::signal_threshold*count) {
-                        if (DEBUG) {
+                    for (size_t k=0; k<m_thresholds.size(); ++k) {
+                        if (!(sum > m_thresholds[k]*count)) break;
+                        if (DEBUG && k==0) {
                             std::cout << "Signal " << sum/count << 
                             " at (" << t << ", " << x << ", " << y << ")" << std::endl;
                         }
-                        m_fdet_signal.count[x][y].push_back(t);
+                        m_fdet_signals[k].count[x][y].push_back(t);
                     }
                 }
             }
@@ -185,9 +202,12 @@ public:
 
 
 // Fooble detector code
-std::pair<int, int> detect_fooble_in_cell(tbb::concurrent_vector<size_t> cell_signal) {
+// The cell signal is taken by value as we sort it; the detection time
+// can be overridden when re-running detection from a signal index
+template <typename SignalVector>
+std::pair<int, int> detect_fooble_in_cell(SignalVector cell_signal, size_t det_time = fdet::fooble_det_time) {
     // Give up on hopeless cases...
-    if (cell_signal.size() < fdet::fooble_det_time) return std::pair<int, int>(-1, -1);
+    if (cell_signal.size() < det_time) return std::pair<int, int>(-1, -1);
 
     if (DEBUG) {
         std::cout << "Attempting fooble detection on " << cell_signal.size() 
@@ -204,7 +224,7 @@ std::pair<int, int> detect_fooble_in_cell(tbb::concurrent_vector<size_t> cell_si
     }
     int test_value = -1;
     int last_value = -1;
-    int duration = 1;
+    size_t duration = 1;
     int detection = -1;
     int detection_duration = -1;
     for (size_t i=0; i<cell_signal.size(); ++i) {
@@ -212,13 +232,13 @@ std::pair<int, int> detect_fooble_in_cell(tbb::concurrent_vector<size_t> cell_si
             test_value = cell_signal[i];
             last_value = cell_signal[i];
             duration = 1;
-        } else if (cell_signal[i]==last_value+1) {
+        } else if (cell_signal[i]==size_t(last_value+1)) {
             last_value=cell_signal[i];
             ++duration;
         } else {
-            if (duration >= fdet::fooble_det_time) {
+            if (duration >= det_time) {
                 detection = test_value;
-                detection_duration = duration;
+                detection_duration = int(duration);
             }
             test_value = cell_signal[i];
             last_value = cell_signal[i];
@@ -226,42 +246,144 @@ std::pair<int, int> detect_fooble_in_cell(tbb::concurrent_vector<size_t> cell_si
         }
     }
     // Have to handle properly the end of the window
-    if (duration >= fdet::fooble_det_time) {
+    if (duration >= det_time) {
         detection = test_value;
-        detection_duration = duration; 
+        detection_duration = int(duration);
     }
 
     return std::pair<int, int>(detection, detection_duration);
 }
 
 
-int main(int argn, char* argv[]) {
-    if (argn != 2) {
-        std::cerr << "Usage: solution INPUT_FILE" << std::endl;
-        return 1;
+// Run the fooble detection concurrently across all cells, get_cell
+// returns the signal frames for cell (x,y)
+template <typename CellSignal>
+tbb::concurrent_vector<fooble> detect_foobles(CellSignal get_cell, size_t det_time) {
+    tbb::concurrent_vector<fooble> detected_foobles;
+    tbb::parallel_for(tbb::blocked_range2d<size_t>(0, fdet::detsize, 0, fdet::detsize), 
+        [&](tbb::blocked_range2d<size_t> r){
+            for (size_t x=r.rows().begin(); x!=r.rows().end(); ++x) {
+                for (size_t y=r.cols().begin(); y!=r.cols().end(); ++y) {
+                    auto detect = detect_fooble_in_cell(get_cell(x, y), det_time);
+                    if (detect.first >= 0) {
+                        detected_foobles.push_back(fooble(x, y, detect.first, detect.second));
+                    }
+                }
+            }
+        }
+    );
+    return detected_foobles;
+}
+
+
+void fooble_report(const tbb::concurrent_vector<fooble>& detected_foobles) {
+    std::cout << "Fooble detection report" << std::endl 
+              << "-----------------------" << std::endl;
+    std::cout << detected_foobles.size() << " were found" << std::endl;
+    for (auto f: detected_foobles) {
+        std::cout << "Frame " << f.t << ", duration " << f.d <<
+            " at (" << f.x << ", " << f.y << ")" << std::endl;
     }
+}
 
-    std::ifstream det_in(argv[1], std::ios::binary);
-    if (!det_in.good()) {
-        std::cerr << "Problem opening imput file" << std::endl;
+
+// Flatten the signals into time ordered vectors, one per cell
+// in x*detsize+y order
+std::vector<std::vector<size_t>> sorted_cell_signals(const det_signal& fdet_signal) {
+    std::vector<std::vector<size_t>> cell_signals(fdet::detsize * fdet::detsize);
+    tbb::parallel_for(size_t(0), cell_signals.size(), [&](size_t c) {
+        auto& signal = fdet_signal.count[c / fdet::detsize][c % fdet::detsize];
+        cell_signals[c].assign(signal.begin(), signal.end());
+        std::sort(cell_signals[c].begin(), cell_signals[c].end());
+    });
+    return cell_signals;
+}
+
+
+// Parse a comma separated list of values, e.g., "150,200,250", with
+// parse(item, value) for each item. Stops at the first item that doesn't
+// parse, returning false with the item in bad_item.
+template <typename T, typename Parse>
+bool parse_list(const std::string& list, Parse parse, std::vector<T>& values,
+    std::string& bad_item) {
+    values.clear();
+    std::istringstream is(list);
+    std::string item;
+    while (std::getline(is, item, ',')) {
+        T value;
+        if (!parse(item, value)) {
+            bad_item = item;
+            return false;
+        }
+        values.push_back(value);
+    }
+    return true;
+}
+
+
+// Parse a detection time, which must be a whole number of frames of
+// at least one; returns false if it isn't
+bool parse_det_time(const std::string& text, size_t& det_time) {
+    if (text.empty() || std::isspace(static_cast<unsigned char>(text[0]))) return false;
+    std::istringstream is(text);
+    long value;
+    if (!(is >> value) || !is.eof() || value < 1) return false;
+    det_time = size_t(value);
+    return true;
+}
+
+
+// Parse a signal threshold, which must be the whole of text and a finite
+// number; returns false if it isn't
+bool parse_threshold(const std::string& text, float& threshold) {
+    if (text.empty() || std::isspace(static_cast<unsigned char>(text[0]))) return false;
+    char* end;
+    errno = 0;
+    float value = std::strtof(text.c_str(), &end);
+    if (end != text.c_str() + text.size() || errno == ERANGE || !std::isfinite(value)) return false;
+    threshold = value;
+    return true;
+}
+
+
+// Detection only mode, where the signals are taken from a signal index
+// written by a previous run, so no frame needs to be reprocessed
+int detect_from_index(const char index_file[], size_t det_time) {
+    fdet::signal_index index;
+    if (index.open(index_file)) {
+        std::cerr << "Problem opening signal index " << index_file << std::endl;
         return 2;
     }
+    if (index.detsize() != fdet::detsize) {
+        std::cerr << "Signal index has detector size " << index.detsize() 
+            << ", expected " << fdet::detsize << std::endl;
+        return 2;
+    }
+    std::cout << "Loaded signal index for " << index.n_frames() << " frames, detection time "
+        << det_time << std::endl;
+
+    auto detected_foobles = detect_foobles([&](size_t x, size_t y) {
+        return index.cell_signal(x, y);
+    }, det_time);
+    fooble_report(detected_foobles);
+    return 0;
+}
 
-    // Setup a big vector where we will add all the data
-    // Assume in this case it fits in memory!
-    f_det_vec fdet_data;
-    det_signal fdet_signal;
 
+// Run the frame processing graph, filling one det_signal for each
+// signal threshold; returns the number of frames processed
+size_t process_frames(std::ifstream& det_in, f_det_vec& fdet_data,
+    const std::vector<float>& thresholds, std::vector<det_signal>& fdet_signals) {
     // To make the graph nodes a bit easier define necessary
     // instances here
     frame_loader data_loader(det_in);
     add_frame_data frame_aggregator(fdet_data);
     subtract_pedastal sub_pedastal(fdet_data);
     data_quality_mask dq_cell_mask(fdet_data);
-    signal_search sig_search(fdet_data, fdet_signal);
+    signal_search sig_search(fdet_data, thresholds, fdet_signals);
 
     tbb::flow::graph data_process;
-    tbb::flow::source_node<fdet::f_det> loader(data_process, data_loader, false);
+    tbb::flow::input_node<fdet::f_det> loader(data_process, data_loader);
     tbb::flow::function_node<fdet::f_det, size_t> aggregate(data_process, 1, frame_aggregator);
     tbb::flow::function_node<size_t, size_t> pedastal(data_process, tbb::flow::unlimited, sub_pedastal);
     tbb::flow::function_node<size_t, size_t> mask(data_process, tbb::flow::unlimited, dq_cell_mask);
@@ -275,33 +397,123 @@ int main(int argn, char* argv[]) {
     loader.activate();
     data_process.wait_for_all();
 
+    return fdet_data.size();
+}
+
+
+// Parameter sweep mode, where every frame is processed once and the
+// signal search is evaluated for all thresholds at the same time. Foobles
+// are then reported for every (threshold, detection time) pair.
+int parameter_sweep(std::ifstream& det_in, std::vector<float> thresholds, std::vector<size_t> det_times) {
+    if (thresholds.empty() || det_times.empty()) {
+        std::cerr << "No thresholds or detection times given for the sweep" << std::endl;
+        return 1;
+    }
+    std::sort(thresholds.begin(), thresholds.end());
+
+    f_det_vec fdet_data;
+    std::vector<det_signal> fdet_signals(thresholds.size());
+    size_t frames = process_frames(det_in, fdet_data, thresholds, fdet_signals);
+
+    // Count foobles for each pair, sorting the cell signals only
+    // once per threshold
+    std::vector<std::vector<size_t>> fooble_counts(thresholds.size(), std::vector<size_t>(det_times.size()));
+    tbb::parallel_for(size_t(0), thresholds.size(), [&](size_t k) {
+        auto cell_signals = sorted_cell_signals(fdet_signals[k]);
+        tbb::parallel_for(size_t(0), det_times.size(), [&](size_t d) {
+            auto detected_foobles = detect_foobles([&](size_t x, size_t y) -> const std::vector<size_t>& {
+                return cell_signals[x * fdet::detsize + y];
+            }, det_times[d]);
+            fooble_counts[k][d] = detected_foobles.size();
+        });
+    });
+
+    std::cout << "Fooble parameter sweep over " << frames << " frames" << std::endl
+              << "-----------------------" << std::endl;
+    std::cout << "Threshold DetTime Foobles" << std::endl;
+    for (size_t k=0; k<thresholds.size(); ++k) {
+        for (size_t d=0; d<det_times.size(); ++d) {
+            std::cout << thresholds[k] << " " << det_times[d] << " " << fooble_counts[k][d] << std::endl;
+        }
+    }
+    return 0;
+}
+
+
+int main(int argn, char* argv[]) {
+    if (argn >= 3 && std::string(argv[1]) == "-i") {
+        if (argn > 4) {
+            std::cerr << "Usage: solution -i INDEX_FILE [FOOBLE_DET_TIME]" << std::endl;
+            return 1;
+        }
+        size_t det_time = fdet::fooble_det_time;
+        if (argn == 4 && !parse_det_time(argv[3], det_time)) {
+            std::cerr << "Bad detection time \"" << argv[3] << "\", need a positive number of frames" << std::endl;
+            return 1;
+        }
+        return detect_from_index(argv[2], det_time);
+    }
+    bool do_sweep = (argn >= 2 && std::string(argv[1]) == "-s");
+    if ((do_sweep && (argn < 4 || argn > 5)) || (!do_sweep && (argn < 2 || argn > 3))) {
+        std::cerr << "Usage: solution INPUT_FILE [INDEX_FILE]" << std::endl;
+        std::cerr << "       solution -i INDEX_FILE [FOOBLE_DET_TIME]" << std::endl;
+        std::cerr << "       solution -s INPUT_FILE THRESHOLD[,THRESHOLD...] [DET_TIME[,DET_TIME...]]" << std::endl;
+        return 1;
+    }
+
+    const char* input_file = do_sweep ? argv[2] : argv[1];
+    std::ifstream det_in(input_file, std::ios::binary);
+    if (!det_in.good()) {
+        std::cerr << "Problem opening imput file" << std::endl;
+        return 2;
+    }
+
+    if (do_sweep) {
+        std::vector<float> thresholds;
+        std::string bad_item;
+        if (!parse_list(argv[3], parse_threshold, thresholds, bad_item)) {
+            std::cerr << "Bad threshold \"" << bad_item << "\", need a number" << std::endl;
+            std::cerr << "Usage: solution -s INPUT_FILE THRESHOLD[,THRESHOLD...] [DET_TIME[,DET_TIME...]]" << std::endl;
+            return 1;
+        }
+        std::vector<size_t> det_times{fdet::fooble_det_time};
+        if (argn == 5 && !parse_list(argv[4], parse_det_time, det_times, bad_item)) {
+            std::cerr << "Bad detection time \"" << bad_item << "\", need a positive number of frames" << std::endl;
+            std::cerr << "Usage: solution -s INPUT_FILE THRESHOLD[,THRESHOLD...] [DET_TIME[,DET_TIME...]]" << std::endl;
+            return 1;
+        }
+        return parameter_sweep(det_in, thresholds, det_times);
+    }
+
+    // Setup a big vector where we will add all the data
+    // Assume in this case it fits in memory!
+    f_det_vec fdet_data;
+    std::vector<float> thresholds{fdet::signal_threshold};
+    std::vector<det_signal> fdet_signals(1);
+    process_frames(det_in, fdet_data, thresholds, fdet_signals);
+    det_signal& fdet_signal = fdet_signals[0];
+
     // Now we found all of the signals, but we need to detect foobles
     // by looking at consecutive timeframes
     // We can't really do this with the above flow graph as it was processing
     // at the single timeframe granularity, but we can now do this
     // concurrently across all cells
-    tbb::concurrent_vector<fooble> detected_foobles;
-    tbb::parallel_for(tbb::blocked_range2d<size_t>(0, fdet::detsize, 0, fdet::detsize), 
-        [&](tbb::blocked_range2d<size_t> r){
-            for (size_t x=r.rows().begin(); x!=r.rows().end(); ++x) {
-                for (size_t y=r.cols().begin(); y!=r.cols().end(); ++y) {
-                    auto detect = detect_fooble_in_cell(fdet_signal.count[x][y]);
-                    if (detect.first >= 0) {
-                        detected_foobles.push_back(fooble(x, y, detect.first, detect.second));
-                    }
-                }
-            }
+    auto detected_foobles = detect_foobles([&](size_t x, size_t y) {
+        return fdet_signal.count[x][y];
+    }, fdet::fooble_det_time);
+
+    // Optionally persist the signals so that detection can be re-run later
+    if (argn == 3) {
+        if (fdet::write_signal_index(argv[2], fdet::detsize, fdet_data.size(),
+            sorted_cell_signals(fdet_signal))) {
+            std::cerr << "Problem writing signal index " << argv[2] << std::endl;
+            return 3;
         }
-    );
+        std::cout << "Wrote signal index to " << argv[2] << std::endl;
+    }
 
     // Finally...
-    std::cout << "Fooble detection report" << std::endl 
-              << "-----------------------" << std::endl;
-    std::cout << detected_foobles.size() << " were found" << std::endl;
-    for (auto f: detected_foobles) {
-        std::cout << "Frame " << f.t << ", duration " << f.d <<
-            " at (" << f.x << ", " << f.y << ")" << std::endl;
-    }
+    fooble_report(detected_foobles);
 
     return 0;
 }